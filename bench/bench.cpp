@@ -0,0 +1,417 @@
+/**
+ * @file bench.cpp
+ * @brief Microbenchmarks of the codec kernels and of end-to-end compression (`make bench`).
+ *
+ * The codec translation unit is included directly, so the internal kernels (match finders, BitsetWriter /
+ * BitsetReader, block transposition, delta coding) can be timed on their own. Every benchmark runs over the raw
+ * files of a corpus directory (tests/in/kko.proj.data by default): after BENCH_WARMUP_RUNS untimed runs it is
+ * repeated (5 times by default) and the median run is reported as MB/s and ns per input byte.
+ *
+ * Usage: lz_codec_bench [corpus_dir] [repetitions]
+ *
+ * @author Zdeněk Lapeš (xlapes02)
+ * @date 26/03/2025
+ */
+
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "../src/lz_codec.cpp"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+using namespace lz_codec;
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+static const char *const DEFAULT_CORPUS_PATH = "tests/in/kko.proj.data"; // Corpus when no directory is given
+static const std::size_t DEFAULT_REPETITIONS = 5;                         // Timed runs per benchmark
+static const std::size_t BENCH_WARMUP_RUNS = 1;                           // Untimed runs before the timed ones
+static const std::size_t BRUTE_FORCE_PREFIX = 8 << 10;                    // Bytes per file the brute force scans
+static const int CORPUS_WIDTH = 512;                                      // Image width of the corpus files
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+/**
+ * @struct Corpus
+ * @brief Benchmark input: the raw files of a directory.
+ */
+struct Corpus {
+    std::vector<std::vector<uint8_t>> files; ///< File contents, sorted by name.
+    std::size_t total_size = 0;              ///< Sum of the file sizes.
+};
+
+/**
+ * @struct Token
+ * @brief One token of a pre-parsed stream (input of the bitstream benchmarks).
+ */
+struct Token {
+    lz_match match;          ///< Match, if `match.found`.
+    const uint8_t *literals; ///< Literal characters otherwise.
+    std::size_t count;       ///< Number of literal characters (1 or 2).
+};
+
+/**
+ * @struct TokenStream
+ * @brief Bitstream written by write_tokens().
+ */
+struct TokenStream {
+    std::vector<uint8_t> bytes; ///< Flushed bytes.
+    uint32_t padding_bits;      ///< Zero bits padding the last byte.
+};
+
+/**
+ * @brief Written by every benchmark body so that the compiler cannot drop the measured work.
+ */
+static volatile std::size_t benchmark_sink = 0;
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+/**
+ * @brief Loads every `.raw` file of a directory.
+ * @param path Corpus directory.
+ * @return Loaded corpus.
+ * @throws std::runtime_error if the directory holds no raw file
+ */
+Corpus load_corpus(const std::string &path) {
+    std::vector<std::filesystem::path> paths;
+    for (const auto &entry : std::filesystem::directory_iterator(path)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".raw") {
+            paths.push_back(entry.path());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+
+    Corpus corpus;
+    for (const auto &file_path : paths) {
+        std::ifstream file(file_path, std::ios::binary);
+        corpus.files.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        corpus.total_size += corpus.files.back().size();
+    }
+    if (corpus.files.empty()) {
+        throw std::runtime_error("No .raw files in " + path);
+    }
+    return corpus;
+}
+
+/**
+ * @brief Times a benchmark body and prints its throughput.
+ *
+ * @param name Benchmark name.
+ * @param bytes Input bytes one run of `body` processes.
+ * @param repetitions Number of timed runs; the median is reported.
+ * @param body Work of one run.
+ */
+void run_benchmark(const std::string &name, std::size_t bytes, std::size_t repetitions,
+                   const std::function<void()> &body) {
+    for (std::size_t i = 0; i < BENCH_WARMUP_RUNS; i++) {
+        body();
+    }
+    std::vector<double> seconds;
+    for (std::size_t i = 0; i < repetitions; i++) {
+        const auto start = std::chrono::steady_clock::now();
+        body();
+        const auto end = std::chrono::steady_clock::now();
+        seconds.push_back(std::chrono::duration<double>(end - start).count());
+    }
+    std::sort(seconds.begin(), seconds.end());
+    const double median = seconds[seconds.size() / 2];
+    const double megabytes_per_second = static_cast<double>(bytes) / median / 1e6;
+    const double nanoseconds_per_byte = median * 1e9 / static_cast<double>(bytes);
+    std::printf("%-34s %10zu %10.2f %10.2f %10.3f %10.3f\n", name.c_str(), bytes, megabytes_per_second,
+                nanoseconds_per_byte, median * 1e3, seconds.front() * 1e3);
+}
+
+/**
+ * @brief Greedily scans a stream with the active match finder of `buffers` (the search part of compress_greedy()).
+ * @param buffers Buffers configured with a compression level.
+ * @param data First byte of the stream.
+ * @param size Size of the stream.
+ * @param precomputed_matches Suffix-array matches replacing the match finder, or nullptr.
+ * @return Number of bytes covered by matches.
+ */
+std::size_t scan_matches(Buffer &buffers, const uint8_t *data, std::size_t size,
+                         const SuffixArrayMatchFinder *precomputed_matches) {
+    buffers.reset(data, size);
+    buffers.precomputed_matches = precomputed_matches;
+    return buffers.dispatch_match_finder([&](auto finder) {
+        constexpr MatchFinderType Finder = decltype(finder)::value;
+        std::size_t matched = 0;
+        while (buffers.lookahead_size() > 0) {
+            const lz_match match = buffers.find_match<Finder>();
+            matched += match.found ? match.length : 0;
+            buffers.advance<Finder>(match.found ? match.length : std::min<std::size_t>(2, buffers.lookahead_size()));
+        }
+        return matched;
+    });
+}
+
+/**
+ * @brief Greedily scans the first BRUTE_FORCE_PREFIX bytes of a stream with `Buffer::brute_force_search()`.
+ * @param buffers Buffers to scan with.
+ * @param data First byte of the stream.
+ * @param size Size of the stream.
+ * @return Number of bytes covered by matches.
+ */
+std::size_t scan_matches_brute_force(Buffer &buffers, const uint8_t *data, std::size_t size) {
+    // The brute force needs no match finder state, so the position is moved directly.
+    buffers.reset(data, std::min(size, BRUTE_FORCE_PREFIX));
+    std::size_t matched = 0;
+    while (buffers.lookahead_size() > 0) {
+        const lz_match match = buffers.brute_force_search();
+        matched += match.found ? match.length : 0;
+        buffers.position += match.found ? match.length : std::min<std::size_t>(2, buffers.lookahead_size());
+    }
+    return matched;
+}
+
+/**
+ * @brief Parses a stream greedily at the default level into tokens.
+ * @param data First byte of the stream.
+ * @param size Size of the stream.
+ * @return Tokens covering the stream.
+ */
+std::vector<Token> parse_tokens(const uint8_t *data, std::size_t size) {
+    Buffer buffers;
+    buffers.reset(data, size);
+    std::vector<Token> tokens;
+    buffers.dispatch_match_finder([&](auto finder) {
+        constexpr MatchFinderType Finder = decltype(finder)::value;
+        while (buffers.lookahead_size() > 0) {
+            const lz_match match = buffers.find_match<Finder>();
+            const std::size_t count = match.found ? match.length : std::min<std::size_t>(2, buffers.lookahead_size());
+            tokens.push_back({match, buffers.lookahead(), count});
+            buffers.advance<Finder>(count);
+        }
+    });
+    return tokens;
+}
+
+/**
+ * @brief Writes pre-parsed tokens with a BitsetWriter, entropy coded if the codec selects a coder.
+ * @param codec Codec the writer belongs to.
+ * @param tokens Tokens to write.
+ * @param capacity Bytes to reserve.
+ * @return Written bitstream.
+ */
+TokenStream write_tokens(Codec &codec, const std::vector<Token> &tokens, std::size_t capacity) {
+    BitsetWriter bitset_writer(codec, capacity);
+    for (const Token &token : tokens) {
+        if (token.match.found) {
+            StaticProcessor::write_match_token(token.match, bitset_writer);
+        } else {
+            StaticProcessor::write_literal_token(token.literals, token.count, bitset_writer);
+        }
+    }
+    StaticProcessor::encode_recorded_tokens(codec, bitset_writer);
+    bitset_writer.flush();
+    return {bitset_writer.get_flushed_bytes(), static_cast<uint32_t>(bitset_writer.get_final_padding_bits())};
+}
+
+/**
+ * @brief Reads the fields of every token of a bitstream with a BitsetReader, without decoding matches.
+ * @param stream Bitstream written by write_tokens().
+ * @return Checksum of the read fields.
+ */
+std::size_t read_tokens(const TokenStream &stream) {
+    BitsetReader bitset_reader(stream.bytes.data(), stream.bytes.data() + stream.bytes.size(), stream.padding_bits);
+    std::size_t checksum = 0;
+    while (!bitset_reader.is_at_the_end_of_file()) {
+        if (bitset_reader.read_bits(FLAG_SIZE_BITS) == 1) {
+            checksum += bitset_reader.read_bits(OFFSET_SIZE_BITS + LENGTH_SIZE_BITS);
+        } else {
+            // The last literal token may carry a single character.
+            const std::size_t literal_bits =
+                std::min(2 * CHARACTER_SIZE_BITS, bitset_reader.remaining_bits() - stream.padding_bits);
+            checksum += bitset_reader.read_bits(static_cast<uint32_t>(literal_bits));
+        }
+    }
+    return checksum;
+}
+
+/**
+ * @brief Runs all benchmarks over a corpus.
+ * @param corpus Benchmark input.
+ * @param repetitions Timed runs per benchmark.
+ */
+void run_benchmarks(const Corpus &corpus, std::size_t repetitions) {
+    const std::size_t total = corpus.total_size;
+    std::printf("%zu files, %zu bytes, %zu warmup + %zu timed runs (median reported)\n\n", corpus.files.size(), total,
+                BENCH_WARMUP_RUNS, repetitions);
+    std::printf("%-34s %10s %10s %10s %10s %10s\n", "benchmark", "bytes", "MB/s", "ns/B", "median ms", "best ms");
+
+    // Match finders
+    Buffer buffers;
+    std::size_t brute_force_bytes = 0;
+    for (const auto &file : corpus.files) {
+        brute_force_bytes += std::min(file.size(), BRUTE_FORCE_PREFIX);
+    }
+    run_benchmark("match/brute_force (8 KiB/file)", brute_force_bytes, repetitions, [&]() {
+        for (const auto &file : corpus.files) {
+            benchmark_sink = scan_matches_brute_force(buffers, file.data(), file.size());
+        }
+    });
+    for (const int level : {1, 6, 7, 9}) {
+        buffers.set_compression_level(level);
+        const char *finder =
+            COMPRESSION_LEVELS[level - 1].match_finder == MatchFinderType::BINARY_TREE ? "binary_tree" : "hash_chain";
+        run_benchmark("match/" + std::string(finder) + " -" + std::to_string(level), total, repetitions, [&]() {
+            for (const auto &file : corpus.files) {
+                benchmark_sink = scan_matches(buffers, file.data(), file.size(), nullptr);
+            }
+        });
+    }
+    run_benchmark("match/suffix_array (incl. build)", total, repetitions, [&]() {
+        for (const auto &file : corpus.files) {
+            const SuffixArrayMatchFinder matches(file.data(), file.size(), TokenGeometry());
+            benchmark_sink = scan_matches(buffers, file.data(), file.size(), &matches);
+        }
+    });
+
+    // Bitstream
+    Codec codec{Options()};
+    std::vector<std::vector<Token>> tokens;
+    std::vector<TokenStream> streams;
+    for (const auto &file : corpus.files) {
+        tokens.push_back(parse_tokens(file.data(), file.size()));
+        streams.push_back(write_tokens(codec, tokens.back(), file.size()));
+    }
+    run_benchmark("bitset/writer", total, repetitions, [&]() {
+        for (std::size_t i = 0; i < tokens.size(); i++) {
+            benchmark_sink = write_tokens(codec, tokens[i], corpus.files[i].size()).bytes.size();
+        }
+    });
+    run_benchmark("bitset/reader", total, repetitions, [&]() {
+        for (const auto &stream : streams) {
+            benchmark_sink = read_tokens(stream);
+        }
+    });
+    run_benchmark("decode/tokens", total, repetitions, [&]() {
+        std::vector<uint8_t> output;
+        for (const auto &stream : streams) {
+            BitsetReader bitset_reader(stream.bytes.data(), stream.bytes.data() + stream.bytes.size(),
+                                       stream.padding_bits);
+            output.clear();
+            StaticProcessor::decompress_tokens(bitset_reader, TokenGeometry(), output);
+            benchmark_sink = output.size();
+        }
+    });
+
+    // Entropy coding
+    const std::pair<std::string, EntropyCoder> entropy_coders[] = {
+        {"huffman", EntropyCoder::HUFFMAN}, {"rans", EntropyCoder::RANS}, {"arithmetic", EntropyCoder::ARITHMETIC}};
+    for (const auto &entropy_coder : entropy_coders) {
+        const std::string &name = entropy_coder.first;
+        Options entropy_options;
+        entropy_options.entropy = entropy_coder.second;
+        Codec entropy_codec{entropy_options};
+        CompressionHeader header{};
+        header.width = static_cast<unsigned>(entropy_options.width);
+        header.entropy = entropy_coder.second;
+        std::vector<TokenStream> entropy_streams;
+        for (std::size_t i = 0; i < tokens.size(); i++) {
+            entropy_streams.push_back(write_tokens(entropy_codec, tokens[i], corpus.files[i].size()));
+        }
+        run_benchmark("encode/" + name, total, repetitions, [&]() {
+            for (std::size_t i = 0; i < tokens.size(); i++) {
+                benchmark_sink = write_tokens(entropy_codec, tokens[i], corpus.files[i].size()).bytes.size();
+            }
+        });
+        run_benchmark("decode/" + name, total, repetitions, [&]() {
+            std::vector<uint8_t> output;
+            for (const auto &stream : entropy_streams) {
+                BitsetReader bitset_reader(stream.bytes.data(), stream.bytes.data() + stream.bytes.size(),
+                                           stream.padding_bits);
+                output.clear();
+                StaticProcessor::decode_tokens(bitset_reader, header, output);
+                benchmark_sink = output.size();
+            }
+        });
+    }
+
+    // Preprocessing
+    const std::size_t block_size = ADAPTIVE_BLOCK_WIDTH * ADAPTIVE_BLOCK_HEIGHT;
+    VectorOutput discarded;
+    run_benchmark("transpose_block", total, repetitions, [&]() {
+        for (const auto &file : corpus.files) {
+            const File blocks(codec, file.data(), file.size(), discarded);
+            std::vector<uint8_t> block(block_size);
+            for (std::size_t start = 0; start + block_size <= file.size(); start += block_size) {
+                block.assign(file.begin() + start, file.begin() + start + block_size);
+                benchmark_sink = blocks.transpose_block(block)[1];
+            }
+        }
+    });
+    std::vector<std::vector<uint8_t>> scratch = corpus.files;
+    run_benchmark("transpose_block_in_place", total, repetitions, [&]() {
+        for (auto &file : scratch) {
+            for (std::size_t start = 0; start + block_size <= file.size(); start += block_size) {
+                File::transpose_block_in_place(file.data() + start);
+            }
+            benchmark_sink = file[1];
+        }
+    });
+    run_benchmark("delta_encode", total, repetitions, [&]() {
+        for (auto &file : scratch) {
+            benchmark_sink = delta_encode(file.data(), file.size(), 0);
+        }
+    });
+    run_benchmark("delta_decode", total, repetitions, [&]() {
+        for (auto &file : scratch) {
+            benchmark_sink = delta_decode(file.data(), file.size(), 0);
+        }
+    });
+
+    // End to end
+    Options options;
+    options.width = CORPUS_WIDTH;
+    const std::pair<const char *, std::pair<bool, bool>> modes[] = {
+        {"static", {false, false}},
+        {"static -m", {false, true}},
+        {"adaptive", {true, false}},
+        {"adaptive -m", {true, true}},
+    };
+    for (const auto &[name, flags] : modes) {
+        options.is_adaptive = flags.first;
+        options.is_preprocessed = flags.second;
+        std::vector<std::vector<uint8_t>> compressed(corpus.files.size());
+        run_benchmark("compress/" + std::string(name), total, repetitions, [&]() {
+            for (std::size_t i = 0; i < corpus.files.size(); i++) {
+                compressed[i] = compress(corpus.files[i].data(), corpus.files[i].size(), options);
+            }
+        });
+        run_benchmark("decompress/" + std::string(name), total, repetitions, [&]() {
+            for (std::size_t i = 0; i < compressed.size(); i++) {
+                if (decompress(compressed[i].data(), compressed[i].size()) != corpus.files[i]) {
+                    throw std::runtime_error("Round trip mismatch");
+                }
+            }
+        });
+    }
+}
+
+/**
+ * @brief Entry point of the benchmark binary.
+ * @param argc Argument count.
+ * @param argv Corpus directory and number of repetitions (both optional).
+ * @return 0 on success, 1 on error.
+ */
+int main(int argc, char **argv) {
+    try {
+        const std::string corpus_path = argc > 1 ? argv[1] : DEFAULT_CORPUS_PATH;
+        const std::size_t repetitions = argc > 2 ? std::max(1, std::stoi(argv[2])) : DEFAULT_REPETITIONS;
+        run_benchmarks(load_corpus(corpus_path), repetitions);
+    } catch (const std::exception &err) {
+        std::cerr << err.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -36,6 +36,18 @@ DEFAULT_WIDTH = 512
 # If you want to measure times, set True
 MEASURE_TIMES = True
 
+# Parse modes (--parse) compared against BASELINE_PARSE_MODE after the main table.
+BASELINE_PARSE_MODE = "greedy"
+PARSE_MODES = ["lazy", "lazy2"]
+
+# Compression flags of the four modes benchmarked for every file.
+MODE_FLAGS = {
+    "static": [],
+    "static + preprocess": ["-m"],
+    "adaptive": ["-a"],
+    "adaptive + preprocess": ["-a", "-m"],
+}
+
 
 ###############################################################################
 # Helper Functions
@@ -200,6 +212,48 @@ def run_test(description, input_file, output_file, decompressed_file,
     return res
 
 
+def compare_parse_modes(entropy_map):
+    """
+    Compresses every KKO file in all four modes with BASELINE_PARSE_MODE and each of PARSE_MODES,
+    and prints the ratio and compression time deltas against the baseline.
+    Returns the number of failed round trips.
+    """
+    fails = 0
+    rows = []
+    for kko_file in KKO_FILES:
+        input_path = os.path.join(KKO_DATA_PATH, kko_file)
+        for mode, flags in MODE_FLAGS.items():
+            results = {}
+            for parse_mode in [BASELINE_PARSE_MODE] + PARSE_MODES:
+                suffix = f"_{mode.replace(' + ', '_')}_{parse_mode}"
+                out_file = generate_output_file_name(kko_file, suffix + ".lz")
+                dec_file = generate_decompressed_file_name(kko_file) + suffix
+                cargs = [EXECUTABLE, "-i", input_path, "-o", out_file, "-w", str(DEFAULT_WIDTH), "-c",
+                         "--parse", parse_mode] + flags
+                dargs = [EXECUTABLE, "-i", out_file, "-o", dec_file, "-d"]
+                r = run_test(f"{kko_file} ({mode}, {parse_mode})", input_path, out_file, dec_file,
+                             cargs, dargs, entropy_map[kko_file])
+                fails += not r["ok"]
+                results[parse_mode] = r
+            rows.append((kko_file, mode, results))
+
+    print(f"\nParse modes vs {BASELINE_PARSE_MODE} (ratio delta in percentage points, compression time delta):\n")
+    print(f"{'File':<12} {'Mode':<22} {'Parse':<8} {'Ratio(%)':>9} {'dRatio':>8} {'Time(s)':>8} {'dTime':>8}")
+    for kko_file, mode, results in rows:
+        base = results[BASELINE_PARSE_MODE]
+        for parse_mode in PARSE_MODES:
+            r = results[parse_mode]
+            if not r["ok"] or not base["ok"]:
+                print(f"{kko_file:<12} {mode:<22} {parse_mode:<8} {'FAIL':>9}")
+                continue
+            ratio_delta = r["ratio"] - base["ratio"]
+            time_delta = (r["compression_time"] / base["compression_time"] - 1.0) * 100.0 \
+                if base["compression_time"] > 0 else 0.0
+            print(f"{kko_file:<12} {mode:<22} {parse_mode:<8} {r['ratio']:>9.2f} {ratio_delta:>+8.2f} "
+                  f"{r['compression_time']:>8.3f} {time_delta:>+7.1f}%")
+    return fails
+
+
 ###############################################################################
 # Main
 ###############################################################################
@@ -345,8 +399,11 @@ def main():
     print(r"\end{tabular}")
     print()
 
+    # 3) Compare lazy parsing against greedy parsing
+    parse_fails = compare_parse_modes(entropy_map)
+
     # Optionally detect number of fails/warnings
-    fails = sum(not x["ok"] for x in results)
+    fails = sum(not x["ok"] for x in results) + parse_fails
     if fails > 0:
         print(f"There were {fails} failing tests. See above for details.")
     else:
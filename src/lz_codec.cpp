@@ -0,0 +1,4814 @@
+/**
+ * @file lz_codec.cpp
+ * @brief Dictionary-based LZSS compression and decompression with optional delta encoding and adaptive scanning.
+ *
+ * This is the codec library (liblz_codec, interface in lz_codec.hpp) behind the lz_codec command-line tool: it
+ * compresses and decompresses grayscale image data held in memory or read as a stream using a dictionary
+ * compression method (LZSS), with support for preprocessing (delta encoding) and adaptive image traversal.
+ *
+ * @author Zdeněk Lapeš (xlapes02)
+ * @date 26/03/2025
+ */
+
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "lz_codec.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <queue>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+static const std::size_t FLAG_SIZE_BITS = 1;
+static const std::size_t OFFSET_SIZE_BITS = 13;     // Default window: 2^13 = 8192 bytes for search buffer
+static const std::size_t LENGTH_SIZE_BITS = 5;      // Default lookahead: 2^5 = 32 bytes for look-ahead buffer
+static const std::size_t MIN_OFFSET_SIZE_BITS = 12; // Smallest selectable window (--offset-bits)
+static const std::size_t MAX_OFFSET_SIZE_BITS = 20; // Largest selectable window, 1 MiB
+static const std::size_t MIN_LENGTH_SIZE_BITS = 4;  // Shortest selectable match limit (--length-bits), 15 bytes
+static const std::size_t MAX_LENGTH_SIZE_BITS = 8;  // Longest selectable match limit, 255 bytes
+static const std::size_t MIN_MATCH_LENGTH = 3;      // At least match 3 characters to do compression
+static const std::size_t CHARACTER_SIZE_BITS = 8;
+static const std::size_t ADAPTIVE_BLOCK_WIDTH = 16;
+static const std::size_t ADAPTIVE_BLOCK_HEIGHT = 16;
+static const std::size_t HASH_BITS = 15;              // 2^15 heads in the hash-chain / binary-tree match finders
+static const int DEFAULT_COMPRESSION_LEVEL = 6;       // Level used when no -1..-9 is given
+static const std::size_t NO_POSITION = SIZE_MAX;      // Marks an empty hash head / chain link
+static const std::size_t MATCH_COPY_SLACK = 32;       // Bytes a chunked match copy may write past its end
+static const std::size_t DIRECTION_SWITCH_BITS = 256; // Estimated context loss when the block scan direction flips
+static const std::size_t MIN_CHUNK_SIZE = 64 << 10;           // Smallest container chunk (--chunk-size 64)
+static const std::size_t MAX_CHUNK_SIZE = 64 << 20;           // Largest container chunk (fits a chunk table entry)
+static const std::size_t CHUNK_FLAG_BITS = 4;                 // Stored flag + padding count below a chunk size
+static const std::size_t STREAMED_CHUNK_COUNT = 0xFFFFFFFF;   // Chunk count of a container with a frame per chunk
+static const std::size_t DEFAULT_STREAM_CHUNK_SIZE = 1 << 20; // Chunk size of --stream without --chunk-size
+static const std::size_t INPUT_REFILL_SIZE = 1 << 20;         // Bytes read from an input stream at once
+static const std::size_t INCOMPRESSIBLE_PROBE_COUNT = 4;      // Samples taken before a full LZ pass of a stream
+static const std::size_t INCOMPRESSIBLE_PROBE_SIZE = 4 << 10; // Bytes per sample
+static const std::size_t INCOMPRESSIBLE_PROBE_HASH_BITS = 12; // 2^12 heads in the sample's single-probe hash
+static const uint32_t RECORDED_MATCH_FLAG = 1u << 31;         // Recorded match token flag (offset << 8 | length)
+static const std::size_t ENTROPY_BLOCK_TOKENS = 1 << 16;      // Recorded tokens per entropy coded block (own tables)
+static const std::size_t LITERAL_SYMBOL_COUNT = 256;          // Literal symbols; length symbols follow them
+static const uint32_t ENTROPY_LITERAL_LENGTH_COUNT_BITS = 9;  // Width of the literal/length table's symbol count
+static const uint32_t ENTROPY_OFFSET_COUNT_BITS = 5;          // Width of the offset bucket table's symbol count
+static const uint32_t ENTROPY_ZERO_RUN = 15;                  // Table entry standing for a run of unused symbols
+static const std::size_t ENTROPY_MIN_ZERO_RUN = 3;            // Shortest run of unused symbols coded as a run
+static const std::size_t ENTROPY_MAX_ZERO_RUN = 34;           // Longest run (5 bits above the shortest)
+static const std::size_t HUFFMAN_MAX_CODE_BITS = 12;          // Longest code = width of the decoder's lookup
+static const uint32_t RANS_PROBABILITY_BITS = 12;             // Frequencies of a table sum to 2^12
+static const uint32_t RANS_STATE_LOWER_BOUND = 1u << 23;      // States stay in [2^23, 2^31) between symbols
+static const std::size_t RANS_STATE_COUNT = 4;                // Interleaved states (symbol i uses state i % 4)
+static const uint32_t ARITHMETIC_PROBABILITY_BITS = 11;       // Probabilities of a 0 bit are in 1 / 2^11 units
+static const uint16_t ARITHMETIC_HALF_PROBABILITY = 1 << 10;  // Initial probability: both bit values equally likely
+static const uint32_t ARITHMETIC_ADAPTATION_SHIFT = 5;        // A coded bit moves its probability 1/32 towards it
+static const uint32_t ARITHMETIC_RANGE_TOP = 1u << 24;        // The range is renormalized below this value
+static const std::size_t ARITHMETIC_STATE_COUNT = 4;          // Kinds (literal / match) of the two previous tokens
+static const uint32_t ARITHMETIC_LITERAL_CONTEXT_BITS = 3;    // High bits of the previous and above byte in context
+static const std::size_t ARITHMETIC_LENGTH_CONTEXT_COUNT = 4; // Offset bucket contexts by match length (last: longer)
+static const uint32_t ARITHMETIC_BUCKET_BITS = 5;             // Width of an offset bucket (0..MAX_OFFSET_SIZE_BITS)
+static const uint32_t ARITHMETIC_MODELED_OFFSET_BITS = 6;     // Top extra bits of an offset coded with probabilities
+static const std::size_t LITERAL_TOKEN_BITS = FLAG_SIZE_BITS + 2 * CHARACTER_SIZE_BITS; // 17 bits
+
+//------------------------------------------------------------------------------
+// Macros
+//------------------------------------------------------------------------------
+#define DEBUG_SHIFTING_BUFFERS_AND_READ_NEW_CHAR (0) /// Enable detailed buffer shift logging.
+#define DEBUG_BRUTE_FORCE (0)                        /// Enable internal match search debug printouts.
+#define DEBUG_BRUTE_FORCE_RESULT (0)                 /// Enable final match result debug output.
+#define DEBUG_READ_HEADER (0)                        /// Enable header read debug logging.
+#define DEBUG_WRITE_HEADER (0)                       /// Enable header write debug logging.
+#define DEBUG_PRE_PROCESSING (0)                     /// Enable delta preprocessing debug logging.
+#ifndef USE_LIBDIVSUFSORT
+#define USE_LIBDIVSUFSORT (0) /// Build suffix arrays with libdivsufsort instead of the built-in SA-IS.
+#endif
+
+#define MATCH_LENGTH_SCALAR (0) /// Byte-by-byte comparison.
+#define MATCH_LENGTH_WORD (1)   /// 64-bit XOR with count-trailing-zeros.
+#define MATCH_LENGTH_SSE2 (2)   /// 16-byte SSE2 compare-and-movemask.
+#define MATCH_LENGTH_AVX2 (3)   /// 32-byte AVX2 compare-and-movemask.
+#ifndef MATCH_LENGTH_KERNEL
+#if defined(__AVX2__)
+#define MATCH_LENGTH_KERNEL MATCH_LENGTH_AVX2
+#elif defined(__SSE2__)
+#define MATCH_LENGTH_KERNEL MATCH_LENGTH_SSE2
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define MATCH_LENGTH_KERNEL MATCH_LENGTH_WORD
+#else
+#define MATCH_LENGTH_KERNEL MATCH_LENGTH_SCALAR
+#endif
+#endif
+
+#if USE_LIBDIVSUFSORT
+#include <divsufsort.h>
+#endif
+#if MATCH_LENGTH_KERNEL == MATCH_LENGTH_SSE2
+#include <emmintrin.h>
+#elif MATCH_LENGTH_KERNEL == MATCH_LENGTH_AVX2
+#include <immintrin.h>
+#endif
+
+namespace lz_codec {
+
+/**
+ * @brief Applies delta encoding on the input buffer in-place.
+ *
+ * Each byte is replaced by the difference between itself and the previous byte.
+ *
+ * @param[in,out] data Input data to be encoded (modified in place).
+ */
+void delta_encode(std::vector<uint8_t> &data) {
+    if (DEBUG_PRE_PROCESSING) {
+        std::cout << "Delta encoding" << std::endl;
+    }
+    for (size_t i = data.size() - 1; i > 0; --i) {
+        data[i] = static_cast<uint8_t>(data[i] - data[i - 1]);
+    }
+}
+
+/**
+ * @brief Decodes a buffer that was previously delta-encoded.
+ *
+ * Reconstructs original data by performing cumulative sum of the differences.
+ *
+ * @param[in,out] data Delta-encoded data (modified in place).
+ */
+void delta_decode(std::vector<uint8_t> &data) {
+    if (DEBUG_PRE_PROCESSING) {
+        std::cout << "Delta decoding" << std::endl;
+    }
+    for (size_t i = 1; i < data.size(); ++i) {
+        data[i] = static_cast<uint8_t>(data[i] + data[i - 1]);
+    }
+}
+
+/**
+ * @brief Delta encodes one piece of a longer stream in place, continuing from the byte before it.
+ *
+ * Encoding consecutive pieces with the returned carry gives the same bytes as delta_encode() over the whole stream.
+ *
+ * @param[in,out] data Piece to encode.
+ * @param size Size of the piece.
+ * @param previous Original byte preceding the piece (0 for the first piece).
+ * @return Original last byte of the piece, the carry for the next one.
+ */
+uint8_t delta_encode(uint8_t *data, std::size_t size, uint8_t previous) {
+    for (std::size_t i = 0; i < size; i++) {
+        const uint8_t original = data[i];
+        data[i] = static_cast<uint8_t>(original - previous);
+        previous = original;
+    }
+    return previous;
+}
+
+/**
+ * @brief Delta decodes one piece of a longer stream in place, continuing from the byte before it.
+ * @param[in,out] data Piece to decode.
+ * @param size Size of the piece.
+ * @param previous Decoded byte preceding the piece (0 for the first piece).
+ * @return Decoded last byte of the piece, the carry for the next one.
+ */
+uint8_t delta_decode(uint8_t *data, std::size_t size, uint8_t previous) {
+    for (std::size_t i = 0; i < size; i++) {
+        previous = static_cast<uint8_t>(data[i] + previous);
+        data[i] = previous;
+    }
+    return previous;
+}
+
+/**
+ * @brief Counts the leading bytes two sequences have in common (byte-by-byte reference version).
+ *
+ * @param first First sequence.
+ * @param second Second sequence.
+ * @param limit Maximum number of bytes compared; both sequences must hold at least this many.
+ * @return Length of the common prefix, at most limit.
+ */
+inline std::size_t match_length_scalar(const uint8_t *first, const uint8_t *second, std::size_t limit) {
+    std::size_t length = 0;
+    while (length < limit && first[length] == second[length]) {
+        length++;
+    }
+    return length;
+}
+
+/**
+ * @brief Counts the leading bytes two sequences have in common, comparing several bytes per step.
+ *
+ * The kernel is chosen at compile time by MATCH_LENGTH_KERNEL. Wide loads never reach past limit; the remaining
+ * tail is finished byte by byte, so every kernel returns the same value as match_length_scalar().
+ *
+ * @param first First sequence.
+ * @param second Second sequence.
+ * @param limit Maximum number of bytes compared; both sequences must hold at least this many.
+ * @return Length of the common prefix, at most limit.
+ */
+inline std::size_t match_length(const uint8_t *first, const uint8_t *second, std::size_t limit) {
+    std::size_t length = 0;
+#if MATCH_LENGTH_KERNEL == MATCH_LENGTH_AVX2
+    for (; length + 32 <= limit; length += 32) {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first + length));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(second + length));
+        const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)));
+        if (mask != 0xFFFFFFFFu) {
+            return length + __builtin_ctz(~mask);
+        }
+    }
+#endif
+#if MATCH_LENGTH_KERNEL == MATCH_LENGTH_AVX2 || MATCH_LENGTH_KERNEL == MATCH_LENGTH_SSE2
+    for (; length + 16 <= limit; length += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first + length));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(second + length));
+        const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)));
+        if (mask != 0xFFFFu) {
+            return length + __builtin_ctz(~mask);
+        }
+    }
+#endif
+#if MATCH_LENGTH_KERNEL != MATCH_LENGTH_SCALAR
+    for (; length + 8 <= limit; length += 8) {
+        uint64_t a;
+        uint64_t b;
+        std::memcpy(&a, first + length, sizeof(a));
+        std::memcpy(&b, second + length, sizeof(b));
+        if (a != b) {
+            // Little-endian: the lowest set bit of the XOR lies in the first differing byte.
+            return length + (__builtin_ctzll(a ^ b) >> 3);
+        }
+    }
+#endif
+    return length + match_length_scalar(first + length, second + length, limit - length);
+}
+
+/**
+ * @brief Reads a big-endian 32-bit word (the byte order of the bitstream).
+ * @param bytes First of four bytes.
+ * @return The word.
+ */
+inline uint32_t read_uint32_big_endian(const uint8_t *bytes) {
+    return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) |
+           (static_cast<uint32_t>(bytes[2]) << 8) | bytes[3];
+}
+
+/**
+ * @brief Number of significant bits of a value.
+ * @param value Value to measure.
+ * @return Position of the highest set bit plus one (0 for 0).
+ */
+inline std::size_t bit_length(std::size_t value) {
+    std::size_t length = 0;
+    for (; value != 0; value >>= 1) {
+        length++;
+    }
+    return length;
+}
+
+/**
+ * @brief Copies a match from earlier output to `destination` (the back-reference of a match token).
+ *
+ * Sources at least 16 bytes back are copied in fixed 16-byte chunks; closer sources (overlapping runs included)
+ * replicate the `distance`-byte pattern with doubling copies. The chunked copy may write up to
+ * MATCH_COPY_SLACK bytes past `destination + length`, which the caller must have allocated.
+ *
+ * @param destination First byte to write; `distance` bytes of output must precede it.
+ * @param distance Distance to the match source (token offset + 1).
+ * @param length Length of the matched sequence.
+ */
+inline void copy_match(uint8_t *destination, std::size_t distance, std::size_t length) {
+    const uint8_t *source = destination - distance;
+    if (distance >= 16) {
+        for (std::size_t i = 0; i < length; i += 16) {
+            std::memcpy(destination + i, source + i, 16);
+        }
+        return;
+    }
+    // destination[i] = destination[i - distance]: copy one period, then keep doubling the replicated prefix.
+    std::size_t copied = std::min(distance, length);
+    std::memcpy(destination, source, copied);
+    while (copied < length) {
+        const std::size_t chunk = std::min(copied, length - copied);
+        std::memcpy(destination + copied, destination, chunk);
+        copied += chunk;
+    }
+}
+
+/**
+ * @brief Runs `task` for every index in [0, task_count) on a pool of worker threads.
+ *
+ * Workers claim the next unclaimed index from a shared counter, so a thread that finishes early keeps taking work
+ * until none is left. With one thread (or one task) everything runs on the calling thread. The first exception
+ * thrown by a task stops the workers from claiming more tasks and is rethrown after all threads joined.
+ *
+ * @param task_count Number of tasks.
+ * @param thread_count Number of workers (at least 1).
+ * @param task Called with the task index and the index of the worker running it (for per-worker state).
+ */
+void parallel_for(std::size_t task_count, std::size_t thread_count,
+                  const std::function<void(std::size_t, std::size_t)> &task) {
+    thread_count = std::max<std::size_t>(1, std::min(thread_count, task_count));
+    std::atomic<std::size_t> next_task{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto worker = [&](std::size_t worker_index) {
+        for (std::size_t i = next_task++; i < task_count; i = next_task++) {
+            try {
+                task(i, worker_index);
+            } catch (...) {
+                const std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next_task = task_count;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < thread_count; i++) {
+        threads.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+/**
+ * @struct TokenGeometry
+ * @brief Bit widths of the offset and length fields of a match token, chosen per file and stored in the header.
+ */
+struct TokenGeometry {
+    std::size_t offset_bits = OFFSET_SIZE_BITS; ///< Offset field width; the window holds 2^offset_bits bytes.
+    std::size_t length_bits = LENGTH_SIZE_BITS; ///< Length field width; matches are at most 2^length_bits - 1 long.
+
+    /**
+     * @brief Number of bytes a match may reach back.
+     * @return Window size.
+     */
+    std::size_t window_size() const { return std::size_t{1} << offset_bits; }
+
+    /**
+     * @brief Size of the lookahead; matches are one byte shorter at most.
+     * @return Lookahead size.
+     */
+    std::size_t lookahead_size() const { return std::size_t{1} << length_bits; }
+
+    /**
+     * @brief Size of a match token in the bitstream.
+     * @return Flag, offset and length bits.
+     */
+    std::size_t match_token_bits() const { return FLAG_SIZE_BITS + offset_bits + length_bits; }
+
+    /**
+     * @brief Whether this is the geometry of the original format (OFFSET_SIZE_BITS, LENGTH_SIZE_BITS).
+     * @return true if the header needs no geometry byte
+     */
+    bool is_default() const { return offset_bits == OFFSET_SIZE_BITS && length_bits == LENGTH_SIZE_BITS; }
+
+    /**
+     * @brief Whether both widths are in the selectable ranges.
+     * @return true if valid
+     */
+    bool is_valid() const {
+        return offset_bits >= MIN_OFFSET_SIZE_BITS && offset_bits <= MAX_OFFSET_SIZE_BITS &&
+               length_bits >= MIN_LENGTH_SIZE_BITS && length_bits <= MAX_LENGTH_SIZE_BITS;
+    }
+};
+
+/**
+ * @struct lz_match
+ * @brief Represents a found LZSS match in the sliding window.
+ */
+struct lz_match {
+    bool found = false;
+    std::size_t offset = 0;
+    std::size_t length = 0;
+};
+
+/**
+ * @enum MatchFinderType
+ * @brief Search structure used by Buffer to find matches in the sliding window.
+ */
+enum class MatchFinderType {
+    HASH_CHAIN,   ///< Singly linked chains of positions sharing a 3-byte prefix hash.
+    BINARY_TREE,  ///< LZMA bt4-style binary trees of window suffixes, one tree per prefix hash.
+    SUFFIX_ARRAY, ///< Matches precomputed for the whole stream from its suffix array (-s).
+};
+
+/**
+ * @brief Compile-time tag of a match finder; selects the specialized parse loops.
+ */
+template <MatchFinderType Finder> using MatchFinderTag = std::integral_constant<MatchFinderType, Finder>;
+
+/**
+ * @struct CompressionLevel
+ * @brief Match finder settings selected by the -1..-9 compression level.
+ */
+struct CompressionLevel {
+    MatchFinderType match_finder; ///< Search structure.
+    std::size_t search_depth;     ///< Max candidates visited per search (chain links or tree nodes).
+};
+
+/// Settings for compression levels 1..9 (index = level - 1), trading CPU time for ratio.
+static const std::array<CompressionLevel, 9> COMPRESSION_LEVELS = {{
+    {MatchFinderType::HASH_CHAIN, 1}, // Single-probe hash
+    {MatchFinderType::HASH_CHAIN, 4},
+    {MatchFinderType::HASH_CHAIN, 16},
+    {MatchFinderType::HASH_CHAIN, 64},
+    {MatchFinderType::HASH_CHAIN, 128},
+    {MatchFinderType::HASH_CHAIN, 256},
+    {MatchFinderType::BINARY_TREE, 32},
+    {MatchFinderType::BINARY_TREE, 128},
+    {MatchFinderType::BINARY_TREE, SIZE_MAX}, // Full tree, bounded by the window; matches brute force
+}};
+
+/**
+ * @class CompressionHeader
+ * @brief Header structure to store metadata about compression.
+ */
+class CompressionHeader {
+  public:
+    unsigned padding_bits_count : 3;          ///< Number of padding bits in last byte.
+    unsigned mode : 1;                        ///< 0 = static scan, 1 = adaptive.
+    unsigned passage : 1;                     ///< 0 = horizontal pass, 1 = vertical.
+    unsigned is_file_compressed : 1;          ///< 0 = raw copy, 1 = compressed.
+    unsigned is_preprocessed : 1;             ///< 0 = no delta, 1 = delta encoded.
+    unsigned is_per_block : 1;                ///< 1 = scan direction chosen per block (side channel), `passage` unused.
+    unsigned is_chunked : 1;                  ///< 1 = static chunk container (shares header bit 7 with `is_per_block`).
+    unsigned width : 16;                      ///< Image width in pixels.
+    TokenGeometry geometry;                   ///< Offset and length field widths of the match tokens.
+    EntropyCoder entropy = EntropyCoder::RAW; ///< How the tokens are coded.
+
+    /**
+     * @brief Check if static scanning mode.
+     * @return true if mode == 0
+     */
+    bool get_is_static() const { return mode == 0; }
+
+    /**
+     * @brief Check if adaptive scanning mode.
+     * @return true if mode == 1
+     */
+    bool get_is_adaptive() const { return mode == 1; }
+    /**
+     * @brief Check if horizontal adaptive scan.
+     * @return true if passage == 0
+     */
+    bool get_is_horizontal() const { return passage == 0; }
+
+    /**
+     * @brief Check if vertical adaptive scan.
+     * @return true if passage == 1
+     */
+    bool get_is_vertical() const { return passage == 1; }
+
+    /**
+     * @brief Check if the scan direction is stored per block.
+     * @return true if is_per_block == 1
+     */
+    bool get_is_per_block() const { return is_per_block == 1; }
+
+    /**
+     * @brief Check if the stream is a container of independently compressed chunks.
+     * @return true if is_chunked == 1
+     */
+    bool get_is_chunked() const { return is_chunked == 1; }
+
+    /**
+     * @brief Check if file is compressed.
+     * @return true if compressed
+     */
+    bool get_is_compressed() const { return is_file_compressed == 1; }
+
+    /**
+     * @brief Check if delta preprocessing was applied.
+     * @return true if preprocessed
+     */
+    bool get_is_preprocessed() const { return is_preprocessed == 1; }
+
+    /**
+     * @brief Get image width from header.
+     * @return width as integer
+     */
+    int get_width() const { return width; }
+
+    /**
+     * @brief Packs the header into the bytes stored in front of the stream.
+     *
+     * byte1 holds the padding count (bits 0-2) and the flags (bits 3-7), byte2 and byte3 the width (LSB first).
+     * Bit 7 is `is_per_block` in adaptive mode and `is_chunked` in static mode.
+     *
+     * With a non-default token geometry byte2 and byte3 are zero (a width is never 0) and three more bytes follow:
+     * the width (LSB first) and the geometry, `offset_bits - MIN_OFFSET_SIZE_BITS` in bits 0-3 and
+     * `length_bits - MIN_LENGTH_SIZE_BITS` in bits 4-6. Bit 7 of the geometry byte announces one more byte with the
+     * entropy coder of the tokens. Default geometry with raw tokens keeps the original three-byte header.
+     *
+     * @return Header bytes (3, 6 or 7).
+     */
+    std::vector<uint8_t> get_bytes() const {
+        const uint8_t byte1 = (padding_bits_count & 0b00000111) | ((mode & 0b1) << 3) | ((passage & 0b1) << 4) |
+                              ((is_file_compressed & 0b1) << 5) | ((is_preprocessed & 0b1) << 6) |
+                              (((is_per_block | is_chunked) & 0b1) << 7);
+        const uint8_t width_low = static_cast<uint8_t>((width >> 0) & 0xFF);  // Lower 8 bits of width
+        const uint8_t width_high = static_cast<uint8_t>((width >> 8) & 0xFF); // Upper 8 bits of width
+        const bool is_raw = entropy == EntropyCoder::RAW;
+        if (geometry.is_default() && is_raw) {
+            return {byte1, width_low, width_high};
+        }
+        const auto geometry_byte = static_cast<uint8_t>((geometry.offset_bits - MIN_OFFSET_SIZE_BITS) |
+                                                        ((geometry.length_bits - MIN_LENGTH_SIZE_BITS) << 4) |
+                                                        (is_raw ? 0 : 0b10000000));
+        if (is_raw) {
+            return {byte1, 0, 0, width_low, width_high, geometry_byte};
+        }
+        return {byte1, 0, 0, width_low, width_high, geometry_byte, static_cast<uint8_t>(entropy)};
+    }
+};
+
+
+//------------------------------------------------------------------------------
+// Forward declarations
+//------------------------------------------------------------------------------
+
+struct Buffer;
+
+class Codec;
+
+class File;
+
+//------------------------------------------------------------------------------
+// Classes
+//------------------------------------------------------------------------------
+/**
+ * @brief Counts symbol occurrences and stores the start (or end) of each bucket.
+ * @param text Input symbols.
+ * @param size Number of symbols.
+ * @param alphabet_size Number of distinct symbol values.
+ * @param buckets Output bucket boundaries.
+ * @param bucket_ends If true, bucket ends are stored, otherwise bucket starts.
+ */
+void get_suffix_buckets(const int32_t *text, int32_t size, int32_t alphabet_size, std::vector<int32_t> &buckets,
+                        bool bucket_ends) {
+    std::fill(buckets.begin(), buckets.end(), 0);
+    for (int32_t i = 0; i < size; i++) {
+        buckets[text[i]]++;
+    }
+    int32_t sum = 0;
+    for (int32_t c = 0; c < alphabet_size; c++) {
+        sum += buckets[c];
+        buckets[c] = bucket_ends ? sum : sum - buckets[c];
+    }
+}
+
+/**
+ * @brief Induces the order of L-type and then S-type suffixes from the already placed ones.
+ */
+void induce_suffix_array(const int32_t *text, int32_t *suffix_array, int32_t size, int32_t alphabet_size,
+                         const std::vector<bool> &is_s_type, std::vector<int32_t> &buckets) {
+    get_suffix_buckets(text, size, alphabet_size, buckets, false);
+    for (int32_t i = 0; i < size; i++) {
+        const int32_t j = suffix_array[i] - 1;
+        if (j >= 0 && !is_s_type[j]) {
+            suffix_array[buckets[text[j]]++] = j;
+        }
+    }
+    get_suffix_buckets(text, size, alphabet_size, buckets, true);
+    for (int32_t i = size - 1; i >= 0; i--) {
+        const int32_t j = suffix_array[i] - 1;
+        if (j >= 0 && is_s_type[j]) {
+            suffix_array[--buckets[text[j]]] = j;
+        }
+    }
+}
+
+/**
+ * @brief Builds a suffix array in linear time with induced sorting (SA-IS, Nong, Zhang & Chan).
+ *
+ * The text must end with a unique sentinel symbol 0 smaller than all other symbols.
+ *
+ * @param text Input symbols in range [0, alphabet_size).
+ * @param suffix_array Output array of `size` suffix start positions.
+ * @param size Number of symbols including the sentinel.
+ * @param alphabet_size Number of distinct symbol values.
+ */
+void sais(const int32_t *text, int32_t *suffix_array, int32_t size, int32_t alphabet_size) {
+    std::vector<bool> is_s_type(size, false);
+    is_s_type[size - 1] = true;
+    for (int32_t i = size - 2; i >= 0; i--) {
+        is_s_type[i] = text[i] < text[i + 1] || (text[i] == text[i + 1] && is_s_type[i + 1]);
+    }
+    auto is_lms = [&is_s_type](int32_t i) { return i > 0 && is_s_type[i] && !is_s_type[i - 1]; };
+
+    // Stage 1: sort LMS substrings
+    std::vector<int32_t> buckets(alphabet_size);
+    get_suffix_buckets(text, size, alphabet_size, buckets, true);
+    std::fill(suffix_array, suffix_array + size, -1);
+    for (int32_t i = 1; i < size; i++) {
+        if (is_lms(i)) {
+            suffix_array[--buckets[text[i]]] = i;
+        }
+    }
+    induce_suffix_array(text, suffix_array, size, alphabet_size, is_s_type, buckets);
+
+    int32_t lms_count = 0;
+    for (int32_t i = 0; i < size; i++) {
+        if (is_lms(suffix_array[i])) {
+            suffix_array[lms_count++] = suffix_array[i];
+        }
+    }
+
+    // Name LMS substrings; equal substrings get equal names
+    std::fill(suffix_array + lms_count, suffix_array + size, -1);
+    int32_t name = 0;
+    int32_t previous = -1;
+    for (int32_t i = 0; i < lms_count; i++) {
+        const int32_t position = suffix_array[i];
+        bool is_different = false;
+        for (int32_t d = 0; d < size; d++) {
+            if (previous == -1 || text[position + d] != text[previous + d] ||
+                is_s_type[position + d] != is_s_type[previous + d]) {
+                is_different = true;
+                break;
+            }
+            if (d > 0 && (is_lms(position + d) || is_lms(previous + d))) {
+                break;
+            }
+        }
+        if (is_different) {
+            name++;
+            previous = position;
+        }
+        suffix_array[lms_count + position / 2] = name - 1;
+    }
+    for (int32_t i = size - 1, j = size - 1; i >= lms_count; i--) {
+        if (suffix_array[i] >= 0) {
+            suffix_array[j--] = suffix_array[i];
+        }
+    }
+
+    // Stage 2: sort the reduced problem (recursively if names are not unique yet)
+    int32_t *reduced_suffix_array = suffix_array;
+    int32_t *reduced_text = suffix_array + size - lms_count;
+    if (name < lms_count) {
+        sais(reduced_text, reduced_suffix_array, lms_count, name);
+    } else {
+        for (int32_t i = 0; i < lms_count; i++) {
+            reduced_suffix_array[reduced_text[i]] = i;
+        }
+    }
+
+    // Stage 3: induce the full suffix array from the sorted LMS suffixes
+    get_suffix_buckets(text, size, alphabet_size, buckets, true);
+    for (int32_t i = 1, j = 0; i < size; i++) {
+        if (is_lms(i)) {
+            reduced_text[j++] = i;
+        }
+    }
+    for (int32_t i = 0; i < lms_count; i++) {
+        reduced_suffix_array[i] = reduced_text[reduced_suffix_array[i]];
+    }
+    std::fill(suffix_array + lms_count, suffix_array + size, -1);
+    for (int32_t i = lms_count - 1; i >= 0; i--) {
+        const int32_t j = suffix_array[i];
+        suffix_array[i] = -1;
+        suffix_array[--buckets[text[j]]] = j;
+    }
+    induce_suffix_array(text, suffix_array, size, alphabet_size, is_s_type, buckets);
+}
+
+/**
+ * @brief Builds the suffix array of a byte buffer (same contract as libdivsufsort's `divsufsort()`).
+ * @param data Input bytes.
+ * @param size Number of input bytes.
+ * @return Suffix array: start positions of all suffixes in lexicographic order.
+ */
+std::vector<int32_t> build_suffix_array(const uint8_t *data, std::size_t size) {
+    if (size >= static_cast<std::size_t>(INT32_MAX)) {
+        throw std::runtime_error("Input is too large for suffix array match finder.");
+    }
+    const auto n = static_cast<int32_t>(size);
+    std::vector<int32_t> suffix_array(n);
+    if (n == 0) {
+        return suffix_array;
+    }
+#if USE_LIBDIVSUFSORT
+    if (divsufsort(data, suffix_array.data(), n) != 0) {
+        throw std::runtime_error("divsufsort() failed.");
+    }
+#else
+    // Shift bytes by one so that 0 can serve as the unique sentinel SA-IS requires.
+    std::vector<int32_t> text(n + 1);
+    for (int32_t i = 0; i < n; i++) {
+        text[i] = data[i] + 1;
+    }
+    text[n] = 0;
+    std::vector<int32_t> suffix_array_with_sentinel(n + 1);
+    sais(text.data(), suffix_array_with_sentinel.data(), n + 1, 257);
+    // The sentinel suffix always sorts first.
+    std::copy(suffix_array_with_sentinel.begin() + 1, suffix_array_with_sentinel.end(), suffix_array.begin());
+#endif
+    return suffix_array;
+}
+
+/**
+ * @class RankBitmap
+ * @brief Ordered set of integers in [0, capacity) as a hierarchy of 64-bit words (64-ary search tree).
+ *
+ * Insert, erase, predecessor and successor cost O(log64 capacity) bit operations without any allocation.
+ */
+class RankBitmap {
+  public:
+    static const std::size_t NONE = SIZE_MAX; ///< Returned when no predecessor/successor exists.
+
+    /**
+     * @brief Creates an empty set for values in [0, capacity).
+     * @param capacity Upper bound (exclusive) of stored values.
+     */
+    explicit RankBitmap(std::size_t capacity) {
+        std::size_t words = (capacity + 63) / 64;
+        do {
+            levels.emplace_back(std::max<std::size_t>(words, 1), 0);
+            words = (words + 63) / 64;
+        } while (levels.back().size() > 1);
+    }
+
+    /**
+     * @brief Adds a value to the set.
+     * @param value Value to insert.
+     */
+    void insert(std::size_t value) {
+        for (auto &level : levels) {
+            level[value >> 6] |= 1ULL << (value & 63);
+            value >>= 6;
+        }
+    }
+
+    /**
+     * @brief Removes a value from the set.
+     * @param value Value to erase.
+     */
+    void erase(std::size_t value) {
+        for (auto &level : levels) {
+            level[value >> 6] &= ~(1ULL << (value & 63));
+            if (level[value >> 6] != 0) {
+                break;
+            }
+            value >>= 6;
+        }
+    }
+
+    /**
+     * @brief Finds the smallest stored value >= value.
+     * @param value Lower bound.
+     * @return Stored value or NONE.
+     */
+    std::size_t successor(std::size_t value) const {
+        for (std::size_t l = 0; l < levels.size(); l++) {
+            const std::size_t word = value >> 6;
+            if (word >= levels[l].size()) {
+                return NONE;
+            }
+            const uint64_t bits = levels[l][word] & (~0ULL << (value & 63));
+            if (bits != 0) {
+                value = (word << 6) | __builtin_ctzll(bits);
+                while (l-- > 0) {
+                    value = (value << 6) | __builtin_ctzll(levels[l][value]);
+                }
+                return value;
+            }
+            value = word + 1;
+        }
+        return NONE;
+    }
+
+    /**
+     * @brief Finds the largest stored value < value.
+     * @param value Upper bound (exclusive).
+     * @return Stored value or NONE.
+     */
+    std::size_t predecessor(std::size_t value) const {
+        if (value == 0) {
+            return NONE;
+        }
+        value--;
+        for (std::size_t l = 0; l < levels.size(); l++) {
+            const std::size_t word = value >> 6;
+            const uint64_t bits = levels[l][word] & (~0ULL >> (63 - (value & 63)));
+            if (bits != 0) {
+                value = (word << 6) | (63 - __builtin_clzll(bits));
+                while (l-- > 0) {
+                    value = (value << 6) | (63 - __builtin_clzll(levels[l][value]));
+                }
+                return value;
+            }
+            if (word == 0) {
+                return NONE;
+            }
+            value = word - 1;
+        }
+        return NONE;
+    }
+
+  private:
+    std::vector<std::vector<uint64_t>> levels; ///< levels[0] holds one bit per value, each next level one per word.
+};
+
+/**
+ * @class SuffixArrayMatchFinder
+ * @brief Precomputes the longest LZSS match for every position of a buffer from its suffix array.
+ *
+ * Among a set of suffixes, the longest common prefix with suffix `p` is shared with its predecessor or successor in
+ * suffix-array order. Positions are therefore processed left to right while a RankBitmap holds the ranks of all
+ * positions inside the window of the token geometry, which makes each query two neighbour lookups. Matches obey the
+ * same limits as `Buffer::brute_force_search()` so that any parser can use them with the current bitstream.
+ */
+class SuffixArrayMatchFinder {
+  public:
+    /**
+     * @brief Builds the suffix array over `data` and precomputes the match for every position.
+     * @param data Whole input stream (as it will be fed to the compressor).
+     * @param size Number of bytes in `data`.
+     * @param geometry Token geometry, which limits the match offsets and lengths.
+     */
+    SuffixArrayMatchFinder(const uint8_t *data, std::size_t size, const TokenGeometry &geometry)
+        : offsets(size, 0), lengths(size, 0) {
+        if (size == 0) {
+            return;
+        }
+        const std::vector<int32_t> suffix_array = build_suffix_array(data, size);
+        std::vector<int32_t> rank(size);
+        for (std::size_t r = 0; r < size; r++) {
+            rank[suffix_array[r]] = static_cast<int32_t>(r);
+        }
+
+        const std::size_t max_window_size = geometry.window_size();
+        const std::size_t max_match_length = geometry.lookahead_size() - 1;
+        // Sources closer than max_match_length may be cut short by the no-overlap rule, so the rank set only holds
+        // the farther ones and the near ones are compared directly.
+        const std::size_t near_distance = max_match_length;
+        RankBitmap window_ranks(size);
+
+        for (std::size_t position = 0; position < size; position++) {
+            if (position >= near_distance) {
+                window_ranks.insert(rank[position - near_distance]);
+            }
+            if (position > max_window_size) {
+                window_ranks.erase(rank[position - max_window_size - 1]);
+            }
+
+            const std::size_t max_length = std::min(max_match_length, size - position - 1);
+            if (max_length < MIN_MATCH_LENGTH) {
+                continue;
+            }
+            auto common_prefix = [&](std::size_t candidate, std::size_t limit) {
+                return match_length(data + candidate, data + position, limit);
+            };
+
+            std::size_t best_length = 0;
+            std::size_t best_distance = 0;
+            const std::size_t successor = window_ranks.successor(rank[position]);
+            if (successor != RankBitmap::NONE) {
+                const std::size_t candidate = suffix_array[successor];
+                best_length = common_prefix(candidate, max_length);
+                best_distance = position - candidate;
+            }
+            const std::size_t predecessor = window_ranks.predecessor(rank[position]);
+            if (predecessor != RankBitmap::NONE) {
+                const std::size_t candidate = suffix_array[predecessor];
+                const std::size_t length = common_prefix(candidate, max_length);
+                if (length > best_length || (length == best_length && position - candidate < best_distance)) {
+                    best_length = length;
+                    best_distance = position - candidate;
+                }
+            }
+            // A near source can only win if its distance allows a longer match.
+            for (std::size_t distance = std::min(near_distance - 1, position); distance > best_length; distance--) {
+                const std::size_t length = common_prefix(position - distance, std::min(max_length, distance));
+                if (length > best_length || (length == best_length && distance < best_distance)) {
+                    best_length = length;
+                    best_distance = distance;
+                }
+            }
+
+            if (best_length >= MIN_MATCH_LENGTH) {
+                offsets[position] = static_cast<uint32_t>(best_distance - 1);
+                lengths[position] = static_cast<uint8_t>(best_length);
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the precomputed match for a stream position.
+     * @param position Position of the first lookahead character.
+     * @return Longest match (offset relative to the end of the window, as emitted in the bitstream).
+     */
+    lz_match match_at(std::size_t position) const {
+        lz_match match = {false, 0, 0};
+        if (position < lengths.size() && lengths[position] >= MIN_MATCH_LENGTH) {
+            match.found = true;
+            match.offset = offsets[position];
+            match.length = lengths[position];
+        }
+        return match;
+    }
+
+    /**
+     * @brief Number of positions covered by the precomputed matches.
+     * @return Size of the input stream.
+     */
+    std::size_t size() const { return lengths.size(); }
+
+  private:
+    std::vector<uint32_t> offsets; ///< Match offset per position (distance - 1).
+    std::vector<uint8_t> lengths;  ///< Match length per position (0 = no match).
+};
+
+/**
+ * @struct Buffer
+ * @brief Holds the sliding window and lookahead buffer for LZSS compression.
+ *
+ * Both buffers are views into the contiguous stream being compressed (the input buffer in static mode, the
+ * prepared block stream in adaptive mode): the window is the `window_size()` bytes before `position` and the
+ * lookahead the `lookahead_size()` bytes from `position` on, so advancing the buffers is an index increment.
+ * It provides debug utilities and the match finders (brute force, hash chain and binary tree) selected by the
+ * compression level.
+ */
+struct Buffer {
+    const uint8_t *data = nullptr;                            ///< Stream the window and lookahead are views into.
+    std::size_t data_size = 0;                                ///< Size of the stream.
+    std::size_t max_window_size = (1 << OFFSET_SIZE_BITS);    ///< Maximum size of the sliding window.
+    std::size_t max_lookahead_size = (1 << LENGTH_SIZE_BITS); ///< Maximum size of the lookahead buffer.
+    std::size_t position = 0;                                 ///< Stream position of the first lookahead byte.
+    std::vector<std::size_t> hash_head;                       ///< Newest stream position for each 3-byte hash.
+    std::vector<std::size_t> hash_prev; ///< Previous position with the same hash (indexed modulo window size).
+    std::size_t chain_mask = 0;         ///< Index mask of `hash_prev` (its size is a power of two).
+    std::vector<std::size_t> tree_children; ///< Smaller/larger child per position (indexed modulo 2x window size).
+    std::size_t tree_next_position = 0;     ///< First position not yet inserted into the binary tree.
+    MatchFinderType match_finder = COMPRESSION_LEVELS[DEFAULT_COMPRESSION_LEVEL - 1].match_finder; ///< Finder.
+    std::size_t search_depth = COMPRESSION_LEVELS[DEFAULT_COMPRESSION_LEVEL - 1].search_depth; ///< Max candidates.
+    const SuffixArrayMatchFinder *precomputed_matches = nullptr; ///< Whole-stream matches; replaces the finder.
+
+    /**
+     * @brief Default constructor. The position tables are sized by `reset()`.
+     */
+    Buffer() : hash_head(1 << HASH_BITS, NO_POSITION) {}
+
+    /**
+     * @brief Destructor.
+     */
+    ~Buffer() {}
+
+    /**
+     * @brief Points the buffers at the start of a new stream and forgets all hashed positions.
+     *
+     * The position tables cover the window (the tree twice the window), but never more positions than the stream
+     * has, so large windows do not cost a full table clear for every small stream or chunk.
+     *
+     * @param stream Stream to compress (must outlive the compression pass).
+     * @param stream_size Size of the stream.
+     */
+    void reset(const uint8_t *stream, std::size_t stream_size) {
+        data = stream;
+        data_size = stream_size;
+        position = 0;
+        precomputed_matches = nullptr;
+        std::size_t table_size = 1;
+        while (table_size < stream_size && table_size < 2 * max_window_size) {
+            table_size <<= 1;
+        }
+        std::fill(hash_head.begin(), hash_head.end(), NO_POSITION);
+        hash_prev.assign(std::min(table_size, max_window_size), NO_POSITION);
+        chain_mask = hash_prev.size() - 1;
+        if (match_finder == MatchFinderType::BINARY_TREE) {
+            tree_children.assign(2 * table_size, NO_POSITION);
+        } else {
+            tree_children.clear();
+        }
+        tree_next_position = 0;
+    }
+
+    /**
+     * @brief Sets the window and lookahead limits of a token geometry; call before `set_compression_level()`.
+     * @param geometry Offset and length field widths.
+     */
+    void set_geometry(const TokenGeometry &geometry) {
+        max_window_size = geometry.window_size();
+        max_lookahead_size = geometry.lookahead_size();
+    }
+
+    /**
+     * @brief Selects the match finder and search depth of a compression level.
+     * @param level Compression level 1..9.
+     */
+    void set_compression_level(int level) {
+        const CompressionLevel &settings = COMPRESSION_LEVELS.at(level - 1);
+        match_finder = settings.match_finder;
+        search_depth = std::min(settings.search_depth, max_window_size);
+    }
+
+    /**
+     * @brief Number of already processed bytes that matches can refer to.
+     * @return Window size.
+     */
+    std::size_t window_size() const { return std::min(position, max_window_size); }
+
+    /**
+     * @brief Number of bytes waiting to be encoded, capped at the maximum lookahead size.
+     * @return Lookahead size (0 once the whole stream is encoded).
+     */
+    std::size_t lookahead_size() const { return std::min(data_size - position, max_lookahead_size); }
+
+    /**
+     * @brief First byte of the window.
+     * @return Pointer into the stream.
+     */
+    const uint8_t *window() const { return data + position - window_size(); }
+
+    /**
+     * @brief First byte of the lookahead.
+     * @return Pointer into the stream.
+     */
+    const uint8_t *lookahead() const { return data + position; }
+
+    /**
+     * @brief Moves `count` bytes from the lookahead into the window, linking each into the match finder.
+     * @tparam Finder Match finder the buffers are configured with (see `active_match_finder()`).
+     * @param count Number of bytes to advance (at most `lookahead_size()`).
+     */
+    template <MatchFinderType Finder> void advance(std::size_t count) {
+        for (std::size_t i = 0; i < count; i++) {
+            insert_position<Finder>();
+            position++;
+        }
+    }
+
+    /**
+     * @brief Match finder the buffers currently use; precomputed matches take precedence over the level.
+     * @return Active match finder.
+     */
+    MatchFinderType active_match_finder() const {
+        return precomputed_matches != nullptr ? MatchFinderType::SUFFIX_ARRAY : match_finder;
+    }
+
+    /**
+     * @brief Calls `function` with the MatchFinderTag of the active match finder.
+     *
+     * The finder is fixed for a whole pass, so parse loops are instantiated per finder and dispatched here once
+     * instead of testing the finder for every byte.
+     *
+     * @param function Generic callable taking a MatchFinderTag.
+     * @return Whatever `function` returns.
+     */
+    template <typename Function> auto dispatch_match_finder(Function &&function) {
+        switch (active_match_finder()) {
+        case MatchFinderType::SUFFIX_ARRAY:
+            return function(MatchFinderTag<MatchFinderType::SUFFIX_ARRAY>{});
+        case MatchFinderType::BINARY_TREE:
+            return function(MatchFinderTag<MatchFinderType::BINARY_TREE>{});
+        default:
+            return function(MatchFinderTag<MatchFinderType::HASH_CHAIN>{});
+        }
+    }
+
+    /**
+     * @brief Hashes the 3-byte prefix (MIN_MATCH_LENGTH) starting at a stream position.
+     * @param stream_position Position in the stream (stream_position + 2 must be valid).
+     * @return Hash in range [0, 2^HASH_BITS).
+     */
+    std::size_t hash_prefix(std::size_t stream_position) const {
+        const uint8_t *prefix_bytes = data + stream_position;
+        const uint32_t prefix = (static_cast<uint32_t>(prefix_bytes[0]) << 16) |
+                                (static_cast<uint32_t>(prefix_bytes[1]) << 8) | prefix_bytes[2];
+        return (prefix * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    /**
+     * @brief Links the current position into the match finder; called before the position moves into the window.
+     * @tparam Finder Match finder the buffers are configured with (see `active_match_finder()`).
+     */
+    template <MatchFinderType Finder> void insert_position() {
+        if constexpr (Finder == MatchFinderType::SUFFIX_ARRAY) {
+            // Matches are already known for every position.
+        } else if constexpr (Finder == MatchFinderType::BINARY_TREE) {
+            if (position >= tree_next_position) {
+                binary_tree_search(false);
+            }
+        } else if (lookahead_size() >= MIN_MATCH_LENGTH) {
+            const std::size_t hash = hash_prefix(position);
+            const std::size_t head = hash_head[hash];
+            // Within runs and short periods the head is kept until it is a full match length back: it matches
+            // every later lookahead at least as far as this position would, but is clipped less by the no-overlap
+            // rule. Otherwise the chain fills with positions one or two bytes back that cannot yield a match.
+            if (head != NO_POSITION && position - head < max_lookahead_size) {
+                const std::size_t limit = std::min(lookahead_size(), max_lookahead_size - 1);
+                if (match_length(data + head, lookahead(), limit) == limit) {
+                    return;
+                }
+            }
+            hash_prev[position & chain_mask] = head;
+            hash_head[hash] = position;
+        }
+    }
+
+    /**
+     * @brief Finds the match for the current lookahead with the configured match finder.
+     * @tparam Finder Match finder the buffers are configured with (see `active_match_finder()`).
+     * @return A lz_match struct containing match information (offset, length, found).
+     */
+    template <MatchFinderType Finder> lz_match find_match() {
+        if constexpr (Finder == MatchFinderType::SUFFIX_ARRAY) {
+            return precomputed_matches->match_at(position);
+        } else if constexpr (Finder == MatchFinderType::BINARY_TREE) {
+            return binary_tree_search(true);
+        } else {
+            return hash_chain_search();
+        }
+    }
+
+    /**
+     * @brief Inserts the current position into its binary tree and optionally collects the longest match.
+     *
+     * Works like LZMA's bt4 match finder: the window suffixes sharing a 3-byte prefix hash form a binary search
+     * tree. Walking it from the newest root visits the suffixes closest to the lookahead in lexicographic order,
+     * while the tree is re-rooted at the current position. At most `search_depth` nodes are visited; older
+     * subtrees are cut off. Matches obey the same limits as `brute_force_search()`.
+     *
+     * @param collect_match If false, the position is only inserted (for positions covered by a match).
+     * @return The longest match found (not found if `collect_match` is false).
+     */
+    lz_match binary_tree_search(bool collect_match) {
+        lz_match match = {false, 0, 0};
+        tree_next_position = position + 1;
+        const std::size_t tree_mask = (tree_children.size() / 2) - 1;
+        std::size_t *smaller = &tree_children[2 * (position & tree_mask)];
+        std::size_t *larger = smaller + 1;
+        if (lookahead_size() <= MIN_MATCH_LENGTH) {
+            *smaller = *larger = NO_POSITION;
+            return match;
+        }
+
+        // The tree roots double as hash chain heads, so the chain is kept up to date for the fallback below.
+        const std::size_t hash = hash_prefix(position);
+        std::size_t candidate = hash_head[hash];
+        hash_prev[position & chain_mask] = candidate;
+        hash_head[hash] = position;
+
+        const uint8_t *current = lookahead();
+        const std::size_t max_length = std::min(lookahead_size() - 1, max_lookahead_size - 1);
+        std::size_t smaller_length = 0;
+        std::size_t larger_length = 0;
+        bool is_clipped = false;
+        for (std::size_t depth = 0;; depth++) {
+            if (depth == search_depth || candidate == NO_POSITION || position - candidate > window_size()) {
+                *smaller = *larger = NO_POSITION;
+                break;
+            }
+            std::size_t *pair = &tree_children[2 * (candidate & tree_mask)];
+            const uint8_t *source = data + candidate;
+            // Both subtree bounds share a prefix of at least min(smaller_length, larger_length) with the lookahead.
+            std::size_t length = std::min(smaller_length, larger_length);
+            length += match_length(source + length, current + length, max_length - length);
+            const std::size_t distance = position - candidate;
+            // The match source may not overlap the lookahead.
+            const std::size_t match_length = std::min(length, distance);
+            is_clipped = is_clipped || match_length < length;
+            if (collect_match && match_length > match.length) {
+                match.length = match_length;
+                match.offset = distance - 1;
+            }
+            if (length == max_length) {
+                // Equal up to the limit: the current position replaces the candidate in the tree.
+                *smaller = pair[0];
+                *larger = pair[1];
+                break;
+            }
+            if (source[length] < current[length]) {
+                *smaller = candidate;
+                smaller = pair + 1;
+                candidate = *smaller;
+                smaller_length = length;
+            } else {
+                *larger = candidate;
+                larger = pair;
+                candidate = *larger;
+                larger_length = length;
+            }
+        }
+
+        if (!collect_match) {
+            return match;
+        }
+        // Copies equal up to the length limit replace each other in the tree, so a nearby copy hides the older
+        // ones. When the no-overlap rule clipped a nearby copy, look for a longer match along the hash chain.
+        if (is_clipped && match.length < max_length) {
+            match = walk_hash_chain(hash_prev[position & chain_mask], match);
+        }
+        match.found = match.length >= MIN_MATCH_LENGTH;
+        return match;
+    }
+
+    /**
+     * @brief Finds the longest match by walking the hash chain of the lookahead's 3-byte prefix.
+     *
+     * Only window positions sharing the prefix hash are compared, newest first, and at most `search_depth` of
+     * them (see `walk_hash_chain()` for which positions count). Matches obey the same limits as
+     * `brute_force_search()` (no overlap into the lookahead, at most `lookahead_size() - 1` characters).
+     *
+     * @return A lz_match struct containing match information (offset, length, found).
+     */
+    lz_match hash_chain_search() const {
+        lz_match match = {false, 0, 0};
+        if (lookahead_size() <= MIN_MATCH_LENGTH) {
+            return match;
+        }
+        match = walk_hash_chain(hash_head[hash_prefix(position)], match);
+
+        if (DEBUG_BRUTE_FORCE_RESULT) {
+            std::cout << "|is_compressed: " << match.found << " | offset: " << match.offset
+                      << " | length: " << match.length << "|" << std::endl;
+        }
+        return match;
+    }
+
+    /**
+     * @brief Compares the lookahead with up to `search_depth` window positions along a hash chain.
+     *
+     * Positions closer than the longest possible match, and positions directly preceding the previous
+     * candidate, do not count against the depth: the no-overlap rule clips the former, and the latter
+     * only continue a run or period already compared, so neither should use up the budget of a fast level.
+     *
+     * @param candidate First chain position to compare.
+     * @param match Best match so far; only longer matches replace it.
+     * @return The longest match found.
+     */
+    lz_match walk_hash_chain(std::size_t candidate, lz_match match) const {
+        const std::size_t window_start = position - window_size();
+        const std::size_t max_length = std::min(lookahead_size() - 1, max_lookahead_size - 1);
+        const uint8_t *current = lookahead();
+
+        std::size_t previous = NO_POSITION;
+        for (std::size_t chain = 0; chain < search_depth && match.length < max_length;) {
+            if (candidate == NO_POSITION || candidate < window_start) {
+                break;
+            }
+            const uint8_t *source = data + candidate;
+            const std::size_t distance = position - candidate;
+            const std::size_t limit = std::min(max_length, distance);
+            chain += distance >= max_length && candidate + 1 != previous;
+            previous = candidate;
+            // Check the byte that would extend the best match first; most candidates fail there.
+            if (limit > match.length && source[match.length] == current[match.length]) {
+                const std::size_t length = match_length(source, current, limit);
+                if (length > match.length) {
+                    match.length = length;
+                    match.offset = distance - 1;
+                }
+            }
+            candidate = hash_prev[candidate & chain_mask];
+        }
+
+        match.found = match.length >= MIN_MATCH_LENGTH;
+        return match;
+    }
+
+    /**
+     * @brief Prints both window and lookahead buffer for debugging.
+     * @param msg Message to prefix the debug output with.
+     */
+    void debug_print_buffers(const std::string &msg) {
+        std::cout << "----------------" << std::endl << msg << std::endl;
+        this->debug_print_window();
+        this->debug_print_lookahead();
+    }
+
+    /**
+     * @brief Prints the contents of the window buffer.
+     */
+    void debug_print_window() {
+        std::string output(window(), lookahead());
+        std::cout << "Window (size: " << window_size() << "):\n" << output << std::endl;
+    }
+
+    /**
+     * @brief Prints the contents of the lookahead buffer.
+     */
+    void debug_print_lookahead() {
+        std::string output(lookahead(), lookahead() + lookahead_size());
+        std::cout << "Lookahead (size: " << lookahead_size() << "):\n" << output << std::endl;
+    }
+
+    /**
+     * @brief Finds the longest match between the window and the lookahead buffer.
+     * @return A lz_match struct containing match information (offset, length, found).
+     */
+    lz_match brute_force_search() {
+        lz_match match = {false, 0, 0};
+        const uint8_t *window = this->window();
+        const uint8_t *lookahead = this->lookahead();
+        const std::size_t window_size = this->window_size();
+        const std::size_t lookahead_size = this->lookahead_size();
+
+        if (DEBUG_BRUTE_FORCE) {
+            debug_print_buffers("Buffers: ");
+        }
+
+        // Iterate over each possible starting position in the window.
+        for (std::size_t i = 0; i < window_size; i++) {
+            // Compare the window starting at 'i' with the lookahead buffer.
+            // NOTE: here must be -1 in: lookahead_size-1 (because when decompressing it overflow the 5 bits so max
+            // match length is 31 chars nto whole 32 chars)
+            const std::size_t limit = std::min(lookahead_size - 1, window_size - i);
+            const std::size_t match_length = lz_codec::match_length(window + i, lookahead, limit);
+            if (DEBUG_BRUTE_FORCE) {
+                std::cout << "|match_length: " << match_length << " | i: " << i << "|\n";
+            }
+            // Update best_match if a longer sequence is found.
+            if (match_length > match.length) {
+                match.found = true;
+                match.length = match_length;
+                // Offset is defined as the distance from the end of the window.
+                match.offset = window_size - i - 1;
+            }
+
+            // Stop if nothing longer can be found
+            if (match.length == max_lookahead_size - 1) {
+                break;
+            }
+        }
+        if (match.length < MIN_MATCH_LENGTH) {
+            match.found = false;
+        }
+
+        if (DEBUG_BRUTE_FORCE_RESULT) {
+            std::cout << "|is_compressed: " << match.found << " | offset: " << match.offset
+                      << " | length: " << match.length << "|" << std::endl;
+        }
+        return match;
+    }
+};
+
+/**
+ * @class Codec
+ * @brief State of one compression or decompression call (options, input and output, buffers).
+ *
+ * Every library call builds its own Codec, so concurrent calls share nothing.
+ */
+class Codec {
+  public:
+    Options options;        ///< Compression settings (decompression only uses the thread count).
+    File *files = nullptr;  ///< Input and output of the call.
+    TokenGeometry geometry; ///< Match token field widths written by compression.
+    Buffer buffers;         ///< Window and match finder state.
+
+    /**
+     * @brief Constructor. Validates the token geometry and compression level and configures the match finder.
+     * @param options Settings of the call.
+     * @throws std::runtime_error if the geometry or the level is out of range
+     */
+    explicit Codec(const Options &options) : options(options), geometry(get_geometry()) {
+        buffers.set_geometry(geometry);
+        buffers.set_compression_level(get_compression_level());
+    }
+
+    /**
+     * @brief Retrieves the image width.
+     * @throws std::runtime_error if width <= 0
+     * @return image width
+     */
+    int get_width() const {
+        if (options.width <= 0) {
+            throw std::runtime_error("Width must be > 0.");
+        }
+        return options.width;
+    }
+
+    /**
+     * @brief Whether preprocessing model (delta) is enabled.
+     * @return true if -m
+     */
+    bool is_preprocess() const { return options.is_preprocessed; }
+
+    /**
+     * @brief Retrieves the compression level.
+     * @throws std::runtime_error if the level is outside 1..9
+     * @return compression level
+     */
+    int get_compression_level() const {
+        if (options.level < 1 || options.level > static_cast<int>(COMPRESSION_LEVELS.size())) {
+            throw std::runtime_error("Compression level must be in range 1..9.");
+        }
+        return options.level;
+    }
+
+    /**
+     * @brief Retrieves the token geometry.
+     * @throws std::runtime_error if a width is outside its selectable range
+     * @return offset and length field widths
+     */
+    TokenGeometry get_geometry() const {
+        if (options.offset_bits < static_cast<int>(MIN_OFFSET_SIZE_BITS) ||
+            options.offset_bits > static_cast<int>(MAX_OFFSET_SIZE_BITS)) {
+            throw std::runtime_error("Offset bits must be in range 12..20.");
+        }
+        if (options.length_bits < static_cast<int>(MIN_LENGTH_SIZE_BITS) ||
+            options.length_bits > static_cast<int>(MAX_LENGTH_SIZE_BITS)) {
+            throw std::runtime_error("Length bits must be in range 4..8.");
+        }
+        TokenGeometry token_geometry;
+        token_geometry.offset_bits = static_cast<std::size_t>(options.offset_bits);
+        token_geometry.length_bits = static_cast<std::size_t>(options.length_bits);
+        return token_geometry;
+    }
+
+    /**
+     * @brief Retrieves the parse mode.
+     * @return parse mode
+     */
+    ParseMode get_parse_mode() const { return options.parse_mode; }
+
+    /**
+     * @brief Whether matches are precomputed with the suffix array match finder.
+     * @return true if -s
+     */
+    bool is_suffix_array() const { return options.is_suffix_array; }
+
+    /**
+     * @brief Retrieves the container chunk size.
+     * @throws std::runtime_error if the size is neither 0 nor within MIN_CHUNK_SIZE..MAX_CHUNK_SIZE
+     * @return chunk size in bytes, 0 when the input is compressed as one stream
+     */
+    std::size_t get_chunk_size() const {
+        const std::size_t chunk_size = options.chunk_size;
+        if (chunk_size != 0 && (chunk_size < MIN_CHUNK_SIZE || chunk_size > MAX_CHUNK_SIZE)) {
+            throw std::runtime_error("Chunk size must be 0 or in range 64..65536 KiB.");
+        }
+        return chunk_size;
+    }
+
+    /**
+     * @brief Retrieves the number of worker threads.
+     * @return thread count (at least 1)
+     */
+    std::size_t get_thread_count() const {
+        if (options.thread_count == 0) {
+            return std::max(1u, std::thread::hardware_concurrency());
+        }
+        return options.thread_count;
+    }
+
+    /**
+     * @brief Whether the adaptive scan direction is chosen per block.
+     * @return true if -p
+     */
+    bool is_per_block_passage() const { return options.is_per_block; }
+
+    /**
+     * @brief Whether the call is instrumented (`Options::stats`).
+     * @return true if statistics are collected
+     */
+    bool is_stats() const { return options.stats != nullptr; }
+
+    /**
+     * @brief Adds time to a phase of the statistics; may be called from any thread.
+     * @param name Phase name.
+     * @param seconds Wall time to add.
+     */
+    void add_phase(const char *name, double seconds) {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        options.stats->add_phase(name, seconds);
+    }
+
+    /**
+     * @brief Adds the counts of written tokens to the statistics; may be called from any thread.
+     * @param tokens Token counts of one token stream.
+     */
+    void add_tokens(const Stats &tokens) {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        options.stats->add_tokens(tokens);
+    }
+
+    /**
+     * @brief Counts bytes read and written in the statistics, if collected.
+     * @param read Input bytes.
+     * @param written Output bytes.
+     */
+    void add_bytes(std::size_t read, std::size_t written) {
+        if (is_stats()) {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            options.stats->input_bytes += read;
+            options.stats->output_bytes += written;
+        }
+    }
+
+  private:
+    std::mutex stats_mutex; ///< Serializes updates of `options.stats` from worker threads.
+};
+
+/**
+ * @class PhaseTimer
+ * @brief Adds the wall time of its scope to a phase of the statistics; does nothing without `Options::stats`.
+ */
+class PhaseTimer {
+  public:
+    /**
+     * @brief Starts timing.
+     * @param codec State of the current codec call.
+     * @param name Phase name.
+     */
+    PhaseTimer(Codec &codec, const char *name) : codec(codec.is_stats() ? &codec : nullptr), name(name) {
+        if (this->codec != nullptr) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    /**
+     * @brief Stops timing and records the phase.
+     */
+    ~PhaseTimer() {
+        if (codec != nullptr) {
+            codec->add_phase(name, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+    }
+
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+  private:
+    Codec *codec;                                ///< Codec collecting the phase, nullptr when not instrumented.
+    const char *name;                            ///< Phase name.
+    std::chrono::steady_clock::time_point start; ///< Start of the phase.
+};
+
+/**
+ * @class File
+ * @brief Manages the input and output of a codec call during compression/decompression.
+ *
+ * The input is either a whole buffer in memory or an InputStream read in pieces; the output is an OutputStream.
+ * Provides functionality for block-based reading, writing, transposition, delta preprocessing,
+ * and handling adaptive compression blocks.
+ */
+class File {
+  public:
+    /**
+     * @brief Constructor for an input held in memory.
+     * @param codec State of the current codec call.
+     * @param data First input byte (must outlive the call).
+     * @param size Input size.
+     * @param output Receives the output.
+     */
+    File(Codec &codec, const uint8_t *data, std::size_t size, OutputStream &output)
+        : codec(codec), output(output), buffer(data), buffer_size(size) {
+        EOF_reached = buffer_size == 0;
+    }
+
+    /**
+     * @brief Constructor for an input that is read in pieces with `read_input()`.
+     * @param codec State of the current codec call.
+     * @param input Source of the input.
+     * @param output Receives the output.
+     */
+    File(Codec &codec, InputStream &input, OutputStream &output)
+        : codec(codec), output(output), in(&input), is_streamed(true) {}
+
+    /**
+     * @brief Makes the input buffer writable for in-place preprocessing.
+     *
+     * The input is copied into `input_data` first unless the caller allowed in-place use (`writable_buffer`).
+     *
+     * @return Writable input buffer.
+     */
+    uint8_t *get_writable_buffer() {
+        if (writable_buffer == nullptr) {
+            input_data.assign(buffer, buffer + buffer_size);
+            writable_buffer = input_data.data();
+            buffer = writable_buffer;
+        }
+        return writable_buffer;
+    }
+
+    /**
+     * @brief Reads the input stream to its end.
+     * @return Contents of the stream.
+     */
+    std::vector<uint8_t> read_stream() {
+        std::vector<uint8_t> data;
+        std::size_t size = 0;
+        std::size_t count = 0;
+        do {
+            data.resize(size + INPUT_REFILL_SIZE);
+            count = in->read(data.data() + size, INPUT_REFILL_SIZE);
+            size += count;
+        } while (count == INPUT_REFILL_SIZE);
+        data.resize(size);
+        codec.add_bytes(size, 0);
+        return data;
+    }
+
+    /**
+     * @brief Reads up to `size` input bytes that were not read yet.
+     *
+     * Streaming mode reads them from the input stream, otherwise they are copied from the loaded buffer.
+     *
+     * @param destination Where to store the bytes.
+     * @param size Number of bytes wanted.
+     * @return Number of bytes read; less than `size` only at the end of the input.
+     */
+    std::size_t read_input(uint8_t *destination, std::size_t size) {
+        if (!is_streamed) {
+            const std::size_t count = std::min<std::size_t>(size, buffer_size - buffer_head);
+            if (count > 0) {
+                memcpy(destination, buffer + buffer_head, count);
+            }
+            buffer_head += count;
+            EOF_reached = buffer_head == buffer_size;
+            return count;
+        }
+        PhaseTimer timer(codec, "load");
+        const std::size_t count = in->read(destination, size);
+        EOF_reached = count < size;
+        codec.add_bytes(count, 0);
+        return count;
+    }
+
+    /**
+     * @brief Loads the rest of a streamed input into the buffer, for the decoders that need all of it at once.
+     *
+     * Does nothing unless streaming; afterwards the buffer holds the not yet read input from `buffer_head` 0.
+     */
+    void load_remaining_input() {
+        if (!is_streamed) {
+            return;
+        }
+        PhaseTimer timer(codec, "load");
+        input_data = read_stream();
+        buffer = writable_buffer = input_data.data();
+        buffer_size = input_data.size();
+        buffer_head = 0;
+        EOF_reached = buffer_size == 0;
+        is_streamed = false;
+    }
+
+    /**
+     * @brief Writes bytes straight to the output.
+     * @param bytes First byte.
+     * @param size Number of bytes.
+     * @throws std::runtime_error if the output cannot be written
+     */
+    void write_output(const uint8_t *bytes, std::size_t size) { write_output(bytes, size, nullptr, 0); }
+
+    /**
+     * @brief Writes two byte ranges (e.g. a header and its payload) back to back.
+     * @param head First range.
+     * @param head_size Size of the first range.
+     * @param body Second range.
+     * @param body_size Size of the second range.
+     * @throws std::runtime_error if the output cannot be written
+     */
+    void write_output(const uint8_t *head, std::size_t head_size, const uint8_t *body, std::size_t body_size) {
+        PhaseTimer timer(codec, "write");
+        output.write(head, head_size, body, body_size);
+        codec.add_bytes(0, head_size + body_size);
+    }
+
+    /**
+     * @brief Prepares the contiguous block stream for adaptive compression.
+     *
+     * Every block is optionally transposed and delta encoded and then appended to the stream, so the match finder
+     * can scan all blocks of one pass as a single buffer. Only reads the input, so both passes may call it at once.
+     *
+     * @param block_is_vertical Per block, whether it is transposed (vertical scan); missing entries are false.
+     * @return Concatenated blocks of the pass.
+     */
+    std::vector<uint8_t> prepare_adaptive_blocks_for_compression(const std::vector<bool> &block_is_vertical) const {
+        PhaseTimer timer(codec, "block_prepare");
+        const std::size_t block_size = ADAPTIVE_BLOCK_WIDTH * ADAPTIVE_BLOCK_HEIGHT;
+
+        std::vector<uint8_t> adaptive_stream;
+        adaptive_stream.reserve(buffer_size);
+        std::vector<uint8_t> block;
+        block.reserve(block_size);
+
+        for (std::size_t block_start = 0; block_start < buffer_size; block_start += block_size) {
+            const std::size_t block_end = std::min(block_start + block_size, buffer_size);
+            const std::size_t block_index = block_start / block_size;
+            block.assign(buffer + block_start, buffer + block_end);
+
+            if (block_index < block_is_vertical.size() && block_is_vertical[block_index]) {
+                block = transpose_block(block);
+            }
+
+            // Delta encode if preprocessing is enabled
+            if (codec.is_preprocess()) {
+                delta_encode(block);
+            }
+
+            adaptive_stream.insert(adaptive_stream.end(), block.begin(), block.end());
+        }
+
+        return adaptive_stream;
+    }
+
+    /**
+     * @brief Prepares the block stream for adaptive compression with one scan direction for all blocks.
+     * @param is_vertical Whether every block is transposed (vertical pass).
+     * @return Concatenated blocks of the pass.
+     */
+    std::vector<uint8_t> prepare_adaptive_blocks_for_compression(bool is_vertical) const {
+        return prepare_adaptive_blocks_for_compression(std::vector<bool>(block_count(), is_vertical));
+    }
+
+    /**
+     * @brief Number of adaptive blocks the input splits into (the last one may be partial).
+     * @return Block count.
+     */
+    std::size_t block_count() const {
+        const std::size_t block_size = ADAPTIVE_BLOCK_WIDTH * ADAPTIVE_BLOCK_HEIGHT;
+        return (buffer_size + block_size - 1) / block_size;
+    }
+
+    /**
+     * @brief Restores the decoded block stream in `written_data` to raster order, in place.
+     *
+     * Every block is delta decoded (if preprocessing was used) and then transposed back if it was scanned
+     * vertically, reversing prepare_adaptive_blocks_for_compression().
+     *
+     * @param header Compression header (preprocessing flag).
+     * @param block_is_vertical Per block, whether it was transposed; missing entries are false.
+     */
+    void restore_adaptive_blocks(const CompressionHeader &header, const std::vector<bool> &block_is_vertical) {
+        PhaseTimer timer(codec, "block_restore");
+        const std::size_t block_size = ADAPTIVE_BLOCK_WIDTH * ADAPTIVE_BLOCK_HEIGHT;
+
+        for (std::size_t block_start = 0; block_start < written_data.size(); block_start += block_size) {
+            const std::size_t size = std::min(block_size, written_data.size() - block_start);
+            const std::size_t block_index = block_start / block_size;
+            uint8_t *block = written_data.data() + block_start;
+
+            // Decode if preprocessing was used
+            if (header.get_is_preprocessed()) {
+                delta_decode(block, size, 0);
+            }
+
+            if (size == block_size && block_index < block_is_vertical.size() && block_is_vertical[block_index]) {
+                transpose_block_in_place(block);
+            }
+        }
+    }
+
+    /**
+     * @brief Transposes a full square block in place (a transposition is its own inverse).
+     * @param block ADAPTIVE_BLOCK_WIDTH x ADAPTIVE_BLOCK_HEIGHT pixels.
+     */
+    static void transpose_block_in_place(uint8_t *block) {
+        static_assert(ADAPTIVE_BLOCK_WIDTH == ADAPTIVE_BLOCK_HEIGHT, "in-place transposition needs square blocks");
+        for (std::size_t y = 0; y < ADAPTIVE_BLOCK_HEIGHT; ++y) {
+            for (std::size_t x = y + 1; x < ADAPTIVE_BLOCK_WIDTH; ++x) {
+                std::swap(block[y * ADAPTIVE_BLOCK_WIDTH + x], block[x * ADAPTIVE_BLOCK_HEIGHT + y]);
+            }
+        }
+    }
+
+    /**
+     * @brief Transposes a single image block (e.g., from row-major to column-major).
+     * @param block Block of pixels to transpose.
+     * @return Transposed block.
+     */
+    std::vector<uint8_t> transpose_block(const std::vector<uint8_t> &block) const {
+        std::vector<uint8_t> result(ADAPTIVE_BLOCK_HEIGHT * ADAPTIVE_BLOCK_WIDTH, 0);
+        for (std::size_t y = 0; y < ADAPTIVE_BLOCK_HEIGHT; ++y) {
+            for (std::size_t x = 0; x < ADAPTIVE_BLOCK_WIDTH; ++x) {
+                result[x * ADAPTIVE_BLOCK_HEIGHT + y] = block[y * ADAPTIVE_BLOCK_WIDTH + x];
+            }
+        }
+        return result;
+    }
+
+    /**
+     * @brief Reads next character sequentially from buffer.
+     * @return Next character.
+     */
+    char get_char_sequential() {
+        current_char = buffer[buffer_head];
+        buffer_head++;
+        if (buffer_head == buffer_size) {
+            EOF_reached = true;
+        }
+        return current_char;
+    }
+
+    /**
+     * @brief Reads the next character of the input buffer.
+     * @return Next character.
+     */
+    char get_char() { return get_char_sequential(); }
+
+    /**
+     * @brief Writes a single byte to internal buffer (not immediately to file).
+     * @param in_byte Byte to write.
+     */
+    void write_char(uint8_t in_byte) {
+        written_data.push_back(in_byte); // store before writing to file
+    }
+
+
+    /**
+     * @brief Writes written_data to the output file with one write.
+     */
+    void flush_to_file_not_compressed() { write_output(written_data.data(), written_data.size()); }
+
+    /**
+     * @brief Validates if the image dimensions are compatible with block sizes.
+     * @throws std::runtime_error if dimensions are invalid.
+     */
+    void is_image_format_ok() {
+        const int width = codec.get_width();
+
+        if (width <= 0) {
+            throw std::runtime_error("Invalid image width");
+        }
+
+        if (width % ADAPTIVE_BLOCK_WIDTH != 0) {
+            throw std::runtime_error("Image width is not divisible by block width");
+        }
+
+        int height = static_cast<int>(buffer_size / width);
+
+        if ((buffer_size % width) != 0) {
+            throw std::runtime_error("Image buffer size: " + std::to_string(buffer_size) +
+                                     " is not divisible by image width: " + std::to_string(width));
+        }
+
+        if (height % ADAPTIVE_BLOCK_HEIGHT != 0) {
+            throw std::runtime_error("Image height is not divisible by block height");
+        }
+    }
+
+    Codec &codec;                                ///< Reference to associated codec context.
+    OutputStream &output;                        ///< Destination of the output.
+    InputStream *in = nullptr;                   ///< Input stream while streaming.
+    bool is_streamed = false;                    ///< Whether the input is read in pieces (not loaded).
+    uint8_t current_char = '\0';                 ///< Most recently read character.
+    bool EOF_reached = false;                    ///< Flag indicating if EOF was reached.
+    const uint8_t *buffer = nullptr;             ///< Whole input (caller's buffer or `input_data`).
+    uint8_t *writable_buffer = nullptr;          ///< `buffer` when it may be modified in place.
+    std::size_t buffer_size = 0;                 ///< Size of input buffer.
+    bool is_buffer_delta_encoded = false;        ///< Whether static -m delta encoded `buffer` in place.
+    std::vector<uint8_t> input_data;             ///< Owns the input when it is copied or read from a stream.
+    unsigned long long int buffer_head = 0;      ///< Pointer to current byte in input.
+    unsigned long long int block_size = 16 * 16; ///< Block size (number of pixels).
+    std::vector<uint8_t> written_data;           ///< Buffer storing output before writing.
+};
+
+/**
+ * @class BitsetWriter
+ * @brief Handles writing individual bits to a byte buffer and flushing to file.
+ *
+ * Bits are appended MSB first to a 64-bit accumulator; every time 32 bits are complete they are stored as four
+ * bytes into the pre-reserved `flushed_bytes`, so a whole token costs a few shifts.
+ * It also constructs and writes a compression header based on the codec options.
+ */
+class BitsetWriter {
+  public:
+    /**
+     * @brief Constructs a BitsetWriter for the input of a codec call.
+     *
+     * The output is reserved for the size of the input, which an encoded stream only exceeds when it is stored
+     * uncompressed instead.
+     *
+     * @param codec State of the current codec call.
+     */
+    BitsetWriter(Codec &codec) : BitsetWriter(codec, codec.files->buffer_size) {}
+
+    /**
+     * @brief Constructs a BitsetWriter for a stream of about `capacity` bytes (e.g. one container chunk).
+     * @param codec State of the current codec call.
+     * @param capacity Number of bytes to reserve.
+     */
+    BitsetWriter(Codec &codec, std::size_t capacity)
+        : codec(codec), geometry(codec.geometry), is_recording_tokens(codec.options.entropy != EntropyCoder::RAW),
+          bits_filled(0), accumulator(0), final_padding_bits(0) {
+        flushed_bytes.reserve(capacity + sizeof(uint32_t));
+        if (codec.is_stats()) {
+            token_stats = std::make_unique<Stats>();
+        }
+    }
+
+    /**
+     * @brief Writes `count` least significant bits from `bits` to the buffer.
+     * @param bits The input bits as a 32-bit integer.
+     * @param count The number of bits to write from MSB to LSB (at most 32).
+     */
+    void write_bits(uint32_t bits, uint32_t count) {
+        const uint64_t mask = (uint64_t{1} << count) - 1;
+        accumulator = (accumulator << count) | (bits & mask);
+        bits_filled += count;
+        if (bits_filled >= 32) {
+            bits_filled -= 32;
+            const auto word = static_cast<uint32_t>(accumulator >> bits_filled);
+            const std::size_t size = flushed_bytes.size();
+            flushed_bytes.resize(size + sizeof(word));
+            flushed_bytes[size + 0] = static_cast<uint8_t>(word >> 24);
+            flushed_bytes[size + 1] = static_cast<uint8_t>(word >> 16);
+            flushed_bytes[size + 2] = static_cast<uint8_t>(word >> 8);
+            flushed_bytes[size + 3] = static_cast<uint8_t>(word);
+        }
+    }
+
+    /**
+     * @brief Number of bits written so far.
+     * @return Bit count, including the bits still in the accumulator.
+     */
+    std::size_t get_bit_count() const { return CHARACTER_SIZE_BITS * flushed_bytes.size() + bits_filled; }
+
+    /**
+     * @brief Number of complete bytes written so far (flushed or still in the accumulator).
+     * @return Byte count, excluding a trailing partial byte.
+     */
+    std::size_t get_byte_count() const { return flushed_bytes.size() + bits_filled / 8; }
+
+    /**
+     * @brief Retrieves the flushed byte stream.
+     * @return Reference to vector of flushed bytes.
+     */
+    const std::vector<uint8_t> &get_flushed_bytes() const { return flushed_bytes; }
+
+    /**
+     * @brief Retrieves the token geometry the match tokens are written with.
+     * @return Offset and length field widths.
+     */
+    const TokenGeometry &get_geometry() const { return geometry; }
+
+    /**
+     * @brief Whether tokens are collected for an entropy coder instead of being written as fixed-width fields.
+     * @return true unless the codec writes raw tokens
+     */
+    bool is_recording() const { return is_recording_tokens; }
+
+    /**
+     * @brief Collects a token for the entropy coder.
+     * @param token Literal byte, or RECORDED_MATCH_FLAG | offset << 8 | length.
+     */
+    void record_token(uint32_t token) { recorded_tokens.push_back(token); }
+
+    /**
+     * @brief Hands the collected tokens over to the entropy coder.
+     * @return Tokens in stream order; the writer's list is left empty.
+     */
+    std::vector<uint32_t> take_recorded_tokens() { return std::move(recorded_tokens); }
+
+    /**
+     * @brief Makes `flush_to_file_after_compression()` store the input raw, whatever was written.
+     *
+     * Used when the input was found incompressible before any token was encoded.
+     */
+    void set_stored() { is_stored = true; }
+
+    /**
+     * @brief Counts a written match token in the token statistics (--stats).
+     * @param match Written match.
+     */
+    void count_match_token(const lz_match &match) {
+        if (token_stats) {
+            token_stats->match_tokens++;
+            token_stats->token_bits += is_recording_tokens ? 0 : geometry.match_token_bits();
+            token_stats->match_lengths[match.length]++;
+            token_stats->match_offsets[bit_length(match.offset)]++;
+        }
+    }
+
+    /**
+     * @brief Counts a written literal token in the token statistics (--stats).
+     * @param count Number of characters in the token.
+     */
+    void count_literal_token(std::size_t count) {
+        if (token_stats) {
+            token_stats->literal_tokens++;
+            token_stats->literal_bytes += count;
+            token_stats->token_bits += is_recording_tokens ? 0 : FLAG_SIZE_BITS + count * CHARACTER_SIZE_BITS;
+        }
+    }
+
+    /**
+     * @brief Counts bits an entropy coder wrote for the recorded tokens in the token statistics (--stats).
+     * @param bits Coded bits, code tables included.
+     */
+    void count_coded_bits(std::size_t bits) {
+        if (token_stats) {
+            token_stats->token_bits += bits;
+        }
+    }
+
+    /**
+     * @brief Retrieves the counts of the tokens written so far.
+     * @return Token statistics, or nullptr when the call is not instrumented.
+     */
+    const Stats *get_token_stats() const { return token_stats.get(); }
+
+    /**
+     * @brief Number of zero bits `flush()` padded the last byte with.
+     * @return Padding bit count (0–7).
+     */
+    int get_final_padding_bits() const { return final_padding_bits; }
+
+    /**
+     * @brief Appends whole bytes; the bits written so far must end on a byte boundary.
+     * @param bytes First byte to append.
+     * @param count Number of bytes.
+     * @throws std::runtime_error if the stream is not byte aligned
+     */
+    void write_bytes(const uint8_t *bytes, std::size_t count) {
+        flush_bytes();
+        if (bits_filled != 0) {
+            throw std::runtime_error("Bytes can only be appended on a byte boundary.");
+        }
+        flushed_bytes.insert(flushed_bytes.end(), bytes, bytes + count);
+    }
+
+    /**
+     * @brief Flushes remaining bits in the buffer by padding with zero bits.
+     */
+    void flush() {
+        flush_bytes();
+        final_padding_bits = 0;
+        if (bits_filled > 0) {
+            // Pad the last partial byte with zero bits and record how many were added.
+            final_padding_bits = 8 - bits_filled;
+            flushed_bytes.push_back(static_cast<uint8_t>(accumulator << final_padding_bits));
+            bits_filled = 0;
+        }
+    }
+
+    /**
+     * @brief Finalizes the buffer and writes the header + data to file.
+     * @param is_vertical Whether data is read vertically (used in header).
+     * @param is_per_block Whether the stream starts with a per-block scan direction side channel.
+     * @param is_chunked Whether the stream is a static chunk container.
+     */
+    void flush_to_file_after_compression(const bool is_vertical = false, const bool is_per_block = false,
+                                         const bool is_chunked = false) {
+        this->flush(); // Add padding bits
+
+        // Create and populate the header.
+        CompressionHeader header;
+        header.padding_bits_count = final_padding_bits; // Only 3 bits are used.
+        header.mode = codec.options.is_adaptive;
+        header.passage = is_vertical;
+        header.is_file_compressed = !is_stored && codec.files->buffer_size > flushed_bytes.size();
+        //        header.is_file_compressed = true;
+        //                header.is_file_compressed = false;
+        header.is_preprocessed = codec.is_preprocess();
+        header.is_per_block = is_per_block;
+        header.is_chunked = is_chunked;
+        //        header.is_preprocessed = true;
+        //        header.is_preprocessed = false;
+        const auto width = codec.get_width();
+        header.width = static_cast<unsigned>(width);
+        if (header.get_is_compressed()) {
+            // Stored data has no tokens, so it keeps the short header.
+            header.geometry = geometry;
+            header.entropy = codec.options.entropy;
+        }
+
+        // Write the header as one byte. We pack header in the lower 3 bits.
+        // We assume that header occupies the lower 3 bits and the upper bits are 0.
+        const std::vector<uint8_t> header_bytes = header.get_bytes();
+
+        if (DEBUG_WRITE_HEADER) {
+            std::cout << "Padding: " << header.padding_bits_count << " | mode: " << bool(header.mode)
+                      << " | passage: " << bool(header.passage)
+                      << " | is_file_compressed: " << bool(header.is_file_compressed) << " | width: " << header.width
+                      << "\n";
+            std::cout << "Header bytes:\n";
+            for (std::size_t i = 0; i < header_bytes.size(); i++) {
+                std::cout << "  byte" << i + 1 << ": " << std::bitset<8>(header_bytes[i]) << "\n";
+            }
+        }
+
+        // Header and payload go out together with one writev, straight from the flushed bytes.
+        if (header.get_is_compressed()) {
+            if (token_stats) {
+                codec.add_tokens(*token_stats);
+            }
+            codec.files->write_output(header_bytes.data(), header_bytes.size(), flushed_bytes.data(),
+                                        flushed_bytes.size());
+        } else {
+            // The input is still in memory; only undo the in-place delta encoding of static -m.
+            File *files = codec.files;
+            if (files->is_buffer_delta_encoded) {
+                delta_decode(files->get_writable_buffer(), files->buffer_size, 0);
+                files->is_buffer_delta_encoded = false;
+            }
+            codec.files->write_output(header_bytes.data(), header_bytes.size(), files->buffer, files->buffer_size);
+        }
+    }
+
+  private:
+    /**
+     * @brief Moves the complete bytes of the accumulator into flushed_bytes.
+     */
+    void flush_bytes() {
+        while (bits_filled >= 8) {
+            bits_filled -= 8;
+            flushed_bytes.push_back(static_cast<uint8_t>(accumulator >> bits_filled));
+        }
+    }
+
+    Codec &codec;                          ///< Reference to Codec context for file access and arguments.
+    TokenGeometry geometry;                ///< Field widths of the written match tokens.
+    bool is_recording_tokens;              ///< Whether tokens go to `recorded_tokens` for an entropy coder.
+    std::vector<uint32_t> recorded_tokens; ///< Tokens collected for the entropy coder, in stream order.
+    uint32_t bits_filled;                  ///< Number of pending bits in the low end of `accumulator` (0–31).
+    uint64_t accumulator;                  ///< Pending bits, the oldest one highest.
+    std::vector<uint8_t> flushed_bytes;    ///< Flushed full bytes written from buffer.
+    int final_padding_bits;                ///< Number of zero bits padded in the final flushed byte.
+    bool is_stored = false;                ///< Whether the input is stored raw regardless of the written bits.
+    std::unique_ptr<Stats> token_stats;    ///< Counts of the written tokens (only with --stats).
+};
+
+/**
+ * @class BitsetReader
+ * @brief Reads bits sequentially from a byte stream using internal bit buffering.
+ *
+ * The compressed bytes after the header are read straight from the input buffer into a 64-bit bit buffer (MSB
+ * first), eight bytes per refill while at least eight remain. After `refill()` at least 56 bits are buffered unless
+ * the stream ends first, so a whole token can be decoded with `peek()`/`consume()` and no further checks.
+ * It is used for decompression.
+ */
+class BitsetReader {
+  public:
+    /**
+     * @brief Constructs a BitsetReader over the not yet read part of the input buffer.
+     * @param codec State of the current codec call.
+     * @param header Compression header, used for interpreting padding bits.
+     */
+    BitsetReader(Codec &codec, CompressionHeader &header)
+        : BitsetReader(codec.files->buffer + codec.files->buffer_head,
+                       codec.files->buffer + codec.files->buffer_size, header.padding_bits_count) {}
+
+    /**
+     * @brief Constructs a BitsetReader over a byte range (e.g. one chunk of a container).
+     * @param begin First compressed byte.
+     * @param end End of the compressed bytes.
+     * @param padding_bits_count Number of zero bits padding the last byte.
+     */
+    BitsetReader(const uint8_t *begin, const uint8_t *end, uint32_t padding_bits_count)
+        : next(begin), end(end), padding_bits_count(padding_bits_count) {}
+
+    /**
+     * @brief Tops the bit buffer up to at least 56 bits (or all remaining bits).
+     */
+    void refill() {
+        if (end - next >= static_cast<std::ptrdiff_t>(sizeof(uint64_t))) {
+            uint64_t word;
+            std::memcpy(&word, next, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            word = __builtin_bswap64(word);
+#endif
+            // Bits below the new count are loaded again by the next refill, so they are always consistent.
+            bits |= word >> bit_count;
+            next += (63 - bit_count) >> 3;
+            bit_count |= 56;
+        } else {
+            while (bit_count < 56 && next < end) {
+                bits |= static_cast<uint64_t>(*next++) << (56 - bit_count);
+                bit_count += 8;
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the next `count` bits without consuming them (call `refill()` first).
+     * @param count Number of bits, 1..32.
+     * @return The bits interpreted as an unsigned integer.
+     */
+    uint32_t peek(uint32_t count) const { return static_cast<uint32_t>(bits >> (64 - count)); }
+
+    /**
+     * @brief Drops `count` already peeked bits.
+     * @param count Number of bits.
+     * @throws std::runtime_error if fewer bits are buffered (truncated input)
+     */
+    void consume(uint32_t count) {
+        if (count > bit_count) {
+            throw std::runtime_error("Unexpected end of compressed data.");
+        }
+        bits <<= count;
+        bit_count -= count;
+    }
+
+    /**
+     * @brief Reads `count` bits from the stream (MSB first).
+     * @param count Number of bits to read (1..32).
+     * @return The bits interpreted as an unsigned integer.
+     */
+    uint32_t read_bits(uint32_t count) {
+        if (bit_count < count) {
+            refill();
+        }
+        const uint32_t result = peek(count);
+        consume(count);
+        return result;
+    }
+
+    /**
+     * @brief Skips to the next byte boundary and takes whole bytes; bit reading continues after them.
+     * @param count Number of bytes.
+     * @return First of the bytes (they stay in the input buffer).
+     * @throws std::runtime_error if fewer bytes remain
+     */
+    const uint8_t *read_aligned_bytes(std::size_t count) {
+        consume(static_cast<uint32_t>(bit_count % CHARACTER_SIZE_BITS));
+        const uint8_t *bytes = next - bit_count / CHARACTER_SIZE_BITS;
+        if (static_cast<std::size_t>(end - bytes) < count) {
+            throw std::runtime_error("Unexpected end of compressed data.");
+        }
+        next = bytes + count;
+        bits = 0;
+        bit_count = 0;
+        return bytes;
+    }
+
+    /**
+     * @brief Number of bits not read yet, padding included.
+     * @return Remaining bits.
+     */
+    std::size_t remaining_bits() const {
+        return bit_count + CHARACTER_SIZE_BITS * static_cast<std::size_t>(end - next);
+    }
+
+    /**
+     * @brief Checks if reader is exactly at EOF (including accounting for padding bits).
+     * @return True if EOF is reached and no meaningful bits remain.
+     */
+    bool is_at_the_end_of_file() const { return remaining_bits() <= padding_bits_count; }
+
+  private:
+    const uint8_t *next;         ///< First compressed byte not yet loaded into `bits`.
+    const uint8_t *end;          ///< End of the compressed data.
+    uint64_t bits = 0;           ///< Buffered bits, the next one highest.
+    uint32_t bit_count = 0;      ///< Number of valid bits in `bits`.
+    uint32_t padding_bits_count; ///< Zero bits padding the last byte (from the header or chunk table).
+};
+
+/**
+ * @brief Size of the literal/length alphabet of a token geometry.
+ * @param geometry Token geometry.
+ * @return Literals plus one symbol per match length MIN_MATCH_LENGTH..max.
+ */
+std::size_t literal_length_alphabet_size(const TokenGeometry &geometry) {
+    return LITERAL_SYMBOL_COUNT + geometry.lookahead_size() - MIN_MATCH_LENGTH;
+}
+
+/**
+ * @brief Counts the symbols of a block of recorded tokens.
+ * @param tokens Recorded tokens (see `BitsetWriter::record_token()`).
+ * @param begin First token of the block.
+ * @param end End of the block.
+ * @param literal_length_frequencies Receives the occurrences per literal/length symbol (sized by the caller).
+ * @param offset_frequencies Receives the occurrences per offset bucket (sized by the caller).
+ * @return Number of bytes the block decodes to.
+ */
+std::size_t count_block_symbols(const std::vector<uint32_t> &tokens, std::size_t begin, std::size_t end,
+                                std::vector<uint32_t> &literal_length_frequencies,
+                                std::vector<uint32_t> &offset_frequencies) {
+    std::size_t block_size = 0;
+    for (std::size_t i = begin; i < end; i++) {
+        const uint32_t token = tokens[i];
+        if (token & RECORDED_MATCH_FLAG) {
+            const std::size_t length = token & 0xFF;
+            literal_length_frequencies[LITERAL_SYMBOL_COUNT + length - MIN_MATCH_LENGTH]++;
+            offset_frequencies[bit_length((token & ~RECORDED_MATCH_FLAG) >> 8)]++;
+            block_size += length;
+        } else {
+            literal_length_frequencies[token]++;
+            block_size++;
+        }
+    }
+    return block_size;
+}
+
+/**
+ * @brief Writes a table of small per-symbol values (0 = unused symbol) of an entropy coded block.
+ *
+ * The number of values up to the last used symbol comes first (`count_bits`), then 4 bits per value, where
+ * ENTROPY_ZERO_RUN followed by 5 bits stands for 3..34 unused symbols.
+ *
+ * @param bitset_writer Writer to emit bits.
+ * @param lengths Value per symbol, below ENTROPY_ZERO_RUN.
+ * @param count_bits Width of the value count.
+ */
+void write_symbol_lengths(BitsetWriter &bitset_writer, const std::vector<uint8_t> &lengths, uint32_t count_bits) {
+    std::size_t count = lengths.size();
+    while (count > 0 && lengths[count - 1] == 0) {
+        count--;
+    }
+    bitset_writer.write_bits(static_cast<uint32_t>(count), count_bits);
+    for (std::size_t symbol = 0; symbol < count;) {
+        std::size_t run = 0;
+        while (symbol + run < count && lengths[symbol + run] == 0 && run < ENTROPY_MAX_ZERO_RUN) {
+            run++;
+        }
+        if (run >= ENTROPY_MIN_ZERO_RUN) {
+            bitset_writer.write_bits(ENTROPY_ZERO_RUN, 4);
+            bitset_writer.write_bits(static_cast<uint32_t>(run - ENTROPY_MIN_ZERO_RUN), 5);
+            symbol += run;
+        } else {
+            bitset_writer.write_bits(lengths[symbol], 4);
+            symbol++;
+        }
+    }
+}
+
+/**
+ * @brief Reads a table written by `write_symbol_lengths()`.
+ * @param bitset_reader Reader positioned at the value count.
+ * @param alphabet_size Number of symbols of the alphabet.
+ * @param count_bits Width of the value count.
+ * @param max_length Largest valid value.
+ * @return Value per symbol.
+ * @throws std::runtime_error if the values do not fit the alphabet
+ */
+std::vector<uint8_t> read_symbol_lengths(BitsetReader &bitset_reader, std::size_t alphabet_size, uint32_t count_bits,
+                                         uint32_t max_length) {
+    const std::size_t count = bitset_reader.read_bits(count_bits);
+    if (count > alphabet_size) {
+        throw std::runtime_error("Bad decompression format - bad entropy code table");
+    }
+    std::vector<uint8_t> lengths(alphabet_size, 0);
+    for (std::size_t symbol = 0; symbol < count;) {
+        const uint32_t length = bitset_reader.read_bits(4);
+        if (length == ENTROPY_ZERO_RUN) {
+            symbol += ENTROPY_MIN_ZERO_RUN + bitset_reader.read_bits(5);
+        } else if (length <= max_length) {
+            lengths[symbol++] = static_cast<uint8_t>(length);
+        } else {
+            throw std::runtime_error("Bad decompression format - bad entropy code table");
+        }
+    }
+    return lengths;
+}
+
+/**
+ * @namespace HuffmanCoder
+ * @brief Canonical Huffman entropy stage for the LZ tokens (--entropy huffman).
+ *
+ * The recorded tokens are coded in blocks of up to ENTROPY_BLOCK_TOKENS with their own codes, as in DEFLATE. A
+ * block starts with a last-block bit, the number of bytes it decodes to (32 bits) and the code lengths of two
+ * alphabets: literal/length (LITERAL_SYMBOL_COUNT literals, then one symbol per match length from
+ * MIN_MATCH_LENGTH) and offset buckets (the bit length of the offset; the bits below its top bit follow the symbol
+ * as extra bits). Codes are at most HUFFMAN_MAX_CODE_BITS long, so the decoder resolves every symbol with one
+ * table lookup, and literal/length entries hold two literals whenever both codes fit into the lookup.
+ */
+namespace HuffmanCoder {
+/**
+ * @struct DecodeEntry
+ * @brief Decoding of the HUFFMAN_MAX_CODE_BITS bits a table lookup is indexed with.
+ */
+struct DecodeEntry {
+    uint16_t symbol = 0;    ///< Symbol of the code the bits start with.
+    uint8_t second = 0;     ///< Literal following a literal `symbol` when `bits > first_bits`.
+    uint8_t first_bits = 0; ///< Length of the first code (0 = no code starts with these bits).
+    uint8_t bits = 0;       ///< Length of both codes, or `first_bits` when only one symbol is decoded.
+};
+
+/**
+ * @brief Computes Huffman code lengths of at most HUFFMAN_MAX_CODE_BITS bits.
+ *
+ * Two nodes of the lowest weight are merged until one tree remains. While the tree is too deep, the weights are
+ * halved (keeping them non-zero) and the tree is built again, which flattens it like bzip2 does.
+ *
+ * @param frequencies Occurrences per symbol.
+ * @return Code length per symbol (0 for unused symbols; a single used symbol gets length 1).
+ */
+std::vector<uint8_t> build_code_lengths(const std::vector<uint32_t> &frequencies) {
+    static const std::size_t NO_PARENT = SIZE_MAX;
+    using Node = std::pair<uint64_t, std::size_t>; // Weight and node index; leaves are the symbols.
+    std::vector<uint64_t> weights(frequencies.begin(), frequencies.end());
+    std::vector<uint8_t> lengths(frequencies.size(), 0);
+    for (;;) {
+        std::priority_queue<Node, std::vector<Node>, std::greater<Node>> queue;
+        for (std::size_t symbol = 0; symbol < weights.size(); symbol++) {
+            if (weights[symbol] > 0) {
+                queue.push({weights[symbol], symbol});
+            }
+        }
+        if (queue.size() == 1) {
+            lengths[queue.top().second] = 1;
+        }
+        if (queue.size() <= 1) {
+            return lengths;
+        }
+
+        // Parents are created after their children, so depths follow from the root in reverse creation order.
+        std::vector<std::size_t> parents(weights.size(), NO_PARENT);
+        while (queue.size() > 1) {
+            const Node first = queue.top();
+            queue.pop();
+            const Node second = queue.top();
+            queue.pop();
+            parents[first.second] = parents[second.second] = parents.size();
+            queue.push({first.first + second.first, parents.size()});
+            parents.push_back(NO_PARENT);
+        }
+        std::vector<std::size_t> depths(parents.size(), 0);
+        std::size_t max_depth = 0;
+        for (std::size_t node = parents.size(); node > 0; node--) {
+            if (parents[node - 1] != NO_PARENT) {
+                depths[node - 1] = depths[parents[node - 1]] + 1;
+            }
+        }
+        for (std::size_t symbol = 0; symbol < weights.size(); symbol++) {
+            lengths[symbol] = static_cast<uint8_t>(weights[symbol] > 0 ? depths[symbol] : 0);
+            max_depth = std::max(max_depth, depths[symbol]);
+        }
+        if (max_depth <= HUFFMAN_MAX_CODE_BITS) {
+            return lengths;
+        }
+        for (uint64_t &weight : weights) {
+            weight = weight > 0 ? 1 + weight / 2 : 0;
+        }
+    }
+}
+
+/**
+ * @brief Assigns canonical codes: shorter codes first, codes of equal length in symbol order.
+ * @param lengths Code length per symbol.
+ * @return Code per symbol (its `lengths[symbol]` low bits, written MSB first).
+ */
+std::vector<uint32_t> assign_codes(const std::vector<uint8_t> &lengths) {
+    std::array<uint32_t, HUFFMAN_MAX_CODE_BITS + 1> length_counts{};
+    for (const uint8_t length : lengths) {
+        length_counts[length]++;
+    }
+    length_counts[0] = 0;
+    std::array<uint32_t, HUFFMAN_MAX_CODE_BITS + 1> next_code{};
+    for (std::size_t length = 1; length <= HUFFMAN_MAX_CODE_BITS; length++) {
+        next_code[length] = (next_code[length - 1] + length_counts[length - 1]) << 1;
+    }
+    std::vector<uint32_t> codes(lengths.size(), 0);
+    for (std::size_t symbol = 0; symbol < lengths.size(); symbol++) {
+        if (lengths[symbol] > 0) {
+            codes[symbol] = next_code[lengths[symbol]]++;
+        }
+    }
+    return codes;
+}
+
+/**
+ * @brief Fills a lookup table with the codes of an alphabet.
+ * @param lengths Code length per symbol.
+ * @param table Table of 2^HUFFMAN_MAX_CODE_BITS entries to fill.
+ * @throws std::runtime_error if the lengths describe more codes than fit (not a prefix code)
+ */
+void build_decode_table(const std::vector<uint8_t> &lengths, std::vector<DecodeEntry> &table) {
+    std::size_t used_entries = 0;
+    for (const uint8_t length : lengths) {
+        used_entries += length > 0 ? std::size_t{1} << (HUFFMAN_MAX_CODE_BITS - length) : 0;
+    }
+    if (used_entries > (std::size_t{1} << HUFFMAN_MAX_CODE_BITS)) {
+        throw std::runtime_error("Bad decompression format - bad Huffman code lengths");
+    }
+
+    table.assign(std::size_t{1} << HUFFMAN_MAX_CODE_BITS, DecodeEntry());
+    const std::vector<uint32_t> codes = assign_codes(lengths);
+    for (std::size_t symbol = 0; symbol < lengths.size(); symbol++) {
+        const uint8_t length = lengths[symbol];
+        if (length == 0) {
+            continue;
+        }
+        const std::size_t first = std::size_t{codes[symbol]} << (HUFFMAN_MAX_CODE_BITS - length);
+        const std::size_t count = std::size_t{1} << (HUFFMAN_MAX_CODE_BITS - length);
+        for (std::size_t i = first; i < first + count; i++) {
+            table[i].symbol = static_cast<uint16_t>(symbol);
+            table[i].first_bits = length;
+            table[i].bits = length;
+        }
+    }
+}
+
+/**
+ * @brief Makes literal entries decode a second literal when its whole code lies inside the same lookup.
+ *
+ * The bits after the first code index the entry of the next code; it is used only when its length fits into
+ * the bits left, so only real input bits decide it.
+ *
+ * @param table Literal/length table built by `build_decode_table()`.
+ */
+void pair_literals(std::vector<DecodeEntry> &table) {
+    const std::size_t mask = table.size() - 1;
+    for (std::size_t i = 0; i < table.size(); i++) {
+        DecodeEntry &entry = table[i];
+        if (entry.first_bits == 0 || entry.symbol >= LITERAL_SYMBOL_COUNT) {
+            continue;
+        }
+        const DecodeEntry &next = table[(i << entry.first_bits) & mask];
+        if (next.first_bits != 0 && next.symbol < LITERAL_SYMBOL_COUNT &&
+            entry.first_bits + next.first_bits <= HUFFMAN_MAX_CODE_BITS) {
+            entry.second = static_cast<uint8_t>(next.symbol);
+            entry.bits = static_cast<uint8_t>(entry.first_bits + next.first_bits);
+        }
+    }
+}
+
+/**
+ * @brief Codes recorded tokens into the bitstream, one block per ENTROPY_BLOCK_TOKENS tokens.
+ * @param bitset_writer Writer to emit bits; its geometry limits the alphabets.
+ * @param tokens Recorded tokens (see `BitsetWriter::record_token()`).
+ */
+void encode_tokens(BitsetWriter &bitset_writer, const std::vector<uint32_t> &tokens) {
+    const TokenGeometry &geometry = bitset_writer.get_geometry();
+    const std::size_t literal_length_size = literal_length_alphabet_size(geometry);
+    const std::size_t offset_size = geometry.offset_bits + 1;
+
+    std::size_t begin = 0;
+    do {
+        const std::size_t end = std::min(tokens.size(), begin + ENTROPY_BLOCK_TOKENS);
+        std::vector<uint32_t> literal_length_frequencies(literal_length_size, 0);
+        std::vector<uint32_t> offset_frequencies(offset_size, 0);
+        const std::size_t block_size =
+            count_block_symbols(tokens, begin, end, literal_length_frequencies, offset_frequencies);
+
+        const std::vector<uint8_t> literal_length_lengths = build_code_lengths(literal_length_frequencies);
+        const std::vector<uint8_t> offset_lengths = build_code_lengths(offset_frequencies);
+        const std::vector<uint32_t> literal_length_codes = assign_codes(literal_length_lengths);
+        const std::vector<uint32_t> offset_codes = assign_codes(offset_lengths);
+        bitset_writer.write_bits(end == tokens.size(), 1);
+        bitset_writer.write_bits(static_cast<uint32_t>(block_size), 32);
+        write_symbol_lengths(bitset_writer, literal_length_lengths, ENTROPY_LITERAL_LENGTH_COUNT_BITS);
+        write_symbol_lengths(bitset_writer, offset_lengths, ENTROPY_OFFSET_COUNT_BITS);
+
+        for (std::size_t i = begin; i < end; i++) {
+            const uint32_t token = tokens[i];
+            if (token & RECORDED_MATCH_FLAG) {
+                const std::size_t symbol = LITERAL_SYMBOL_COUNT + (token & 0xFF) - MIN_MATCH_LENGTH;
+                const uint32_t offset = (token & ~RECORDED_MATCH_FLAG) >> 8;
+                const std::size_t bucket = bit_length(offset);
+                bitset_writer.write_bits(literal_length_codes[symbol], literal_length_lengths[symbol]);
+                bitset_writer.write_bits(offset_codes[bucket], offset_lengths[bucket]);
+                if (bucket >= 2) {
+                    bitset_writer.write_bits(offset, static_cast<uint32_t>(bucket - 1));
+                }
+            } else {
+                bitset_writer.write_bits(literal_length_codes[token], literal_length_lengths[token]);
+            }
+        }
+        begin = end;
+    } while (begin < tokens.size());
+}
+
+/**
+ * @brief Decodes all blocks of a Huffman coded token stream into the written data.
+ *
+ * Every block's output is preallocated from its stored size. A literal/length lookup yields one or two literals
+ * or a match length; a match then takes an offset lookup and its extra bits, all from one refill.
+ *
+ * @param bitset_reader Reader positioned at the first block.
+ * @param geometry Token geometry from the compression header.
+ * @param written_data Output the decoded bytes are appended to.
+ * @throws std::runtime_error if the stream is malformed
+ */
+void decode_tokens(BitsetReader &bitset_reader, const TokenGeometry &geometry, std::vector<uint8_t> &written_data) {
+    const std::size_t literal_length_size = literal_length_alphabet_size(geometry);
+    const std::size_t max_block_size = ENTROPY_BLOCK_TOKENS * (geometry.lookahead_size() - 1);
+    std::vector<DecodeEntry> literal_length_table;
+    std::vector<DecodeEntry> offset_table;
+
+    bool is_last_block = false;
+    while (!is_last_block) {
+        is_last_block = bitset_reader.read_bits(1) == 1;
+        const std::size_t block_size = bitset_reader.read_bits(32);
+        if (block_size > max_block_size) {
+            throw std::runtime_error("Bad decompression format - bad Huffman block size");
+        }
+        build_decode_table(read_symbol_lengths(bitset_reader, literal_length_size, ENTROPY_LITERAL_LENGTH_COUNT_BITS,
+                                               HUFFMAN_MAX_CODE_BITS),
+                           literal_length_table);
+        pair_literals(literal_length_table);
+        build_decode_table(read_symbol_lengths(bitset_reader, geometry.offset_bits + 1, ENTROPY_OFFSET_COUNT_BITS,
+                                               HUFFMAN_MAX_CODE_BITS),
+                           offset_table);
+
+        const std::size_t written_size = written_data.size();
+        written_data.resize(written_size + block_size + MATCH_COPY_SLACK);
+        uint8_t *const output_begin = written_data.data();
+        uint8_t *output = output_begin + written_size;
+        uint8_t *const block_end = output + block_size;
+        while (output < block_end) {
+            bitset_reader.refill();
+            const DecodeEntry &entry = literal_length_table[bitset_reader.peek(HUFFMAN_MAX_CODE_BITS)];
+            if (entry.symbol < LITERAL_SYMBOL_COUNT && entry.first_bits != 0) {
+                // The second literal is written into the slack even when the block ends after the first one.
+                output[0] = static_cast<uint8_t>(entry.symbol);
+                output[1] = entry.second;
+                const bool is_pair = entry.bits != entry.first_bits && block_end - output >= 2;
+                bitset_reader.consume(is_pair ? entry.bits : entry.first_bits);
+                output += is_pair ? 2 : 1;
+                continue;
+            }
+            if (entry.first_bits == 0) {
+                throw std::runtime_error("Invalid Huffman code during decompression.");
+            }
+            bitset_reader.consume(entry.first_bits);
+            const std::size_t length = entry.symbol - LITERAL_SYMBOL_COUNT + MIN_MATCH_LENGTH;
+
+            const DecodeEntry &offset_entry = offset_table[bitset_reader.peek(HUFFMAN_MAX_CODE_BITS)];
+            if (offset_entry.first_bits == 0) {
+                throw std::runtime_error("Invalid Huffman code during decompression.");
+            }
+            bitset_reader.consume(offset_entry.first_bits);
+            std::size_t offset = offset_entry.symbol;
+            if (offset >= 2) {
+                const auto extra_bits = static_cast<uint32_t>(offset - 1);
+                offset = (std::size_t{1} << extra_bits) | bitset_reader.peek(extra_bits);
+                bitset_reader.consume(extra_bits);
+            }
+
+            if (offset >= static_cast<std::size_t>(output - output_begin) ||
+                length > static_cast<std::size_t>(block_end - output)) {
+                throw std::runtime_error("Invalid offset during decompression.");
+            }
+            copy_match(output, offset + 1, length);
+            output += length;
+        }
+        written_data.resize(block_end - output_begin);
+    }
+}
+} // namespace HuffmanCoder
+
+/**
+ * @namespace RansCoder
+ * @brief Table-driven rANS entropy stage for the LZ tokens (--entropy rans).
+ *
+ * Blocks hold the same alphabets as the Huffman stage, but their symbols are coded with frequencies quantized to
+ * 2^RANS_PROBABILITY_BITS instead of whole-bit codes, which gets close to arithmetic coding. A block starts with a
+ * last-block bit, the number of bytes it decodes to (32 bits) and the two frequency tables (the bit length of each
+ * frequency as in the Huffman stage, then the bits below its top bit). The number of rANS bytes (32 bits) follows,
+ * then, from the next byte boundary, the rANS bytes and finally the extra bits of the offsets.
+ *
+ * Symbol i of a block is coded with state i % RANS_STATE_COUNT. The states share one byte stream but depend on each
+ * other only through its read position, so the decoder's multiply and table lookups of neighbouring symbols
+ * overlap. Decoding a symbol is a lookup of its slot in a 2^RANS_PROBABILITY_BITS entry table.
+ */
+namespace RansCoder {
+/**
+ * @struct DecodeEntry
+ * @brief Decoding of one slot (the low RANS_PROBABILITY_BITS bits of a state).
+ */
+struct DecodeEntry {
+    uint16_t symbol = 0;    ///< Symbol owning the slot.
+    uint16_t frequency = 0; ///< Frequency of the symbol (0 = unused table).
+    uint16_t bias = 0;      ///< Position of the slot within the symbol's range.
+};
+
+/**
+ * @brief Quantizes symbol occurrences to frequencies summing to 2^RANS_PROBABILITY_BITS.
+ *
+ * Every used symbol keeps a frequency of at least 1; the rounding error is taken from (or given to) the most
+ * frequent symbols, which changes their cost least.
+ *
+ * @param occurrences Occurrences per symbol.
+ * @return Frequency per symbol (all 0 when no symbol is used).
+ */
+std::vector<uint32_t> normalize_frequencies(const std::vector<uint32_t> &occurrences) {
+    const uint32_t total_frequency = uint32_t{1} << RANS_PROBABILITY_BITS;
+    uint64_t total = 0;
+    for (const uint32_t count : occurrences) {
+        total += count;
+    }
+    std::vector<uint32_t> frequencies(occurrences.size(), 0);
+    if (total == 0) {
+        return frequencies;
+    }
+
+    uint32_t sum = 0;
+    for (std::size_t symbol = 0; symbol < occurrences.size(); symbol++) {
+        if (occurrences[symbol] > 0) {
+            const uint64_t scaled = uint64_t{occurrences[symbol]} * total_frequency / total;
+            frequencies[symbol] = std::max<uint32_t>(1, static_cast<uint32_t>(scaled));
+            sum += frequencies[symbol];
+        }
+    }
+    // At most 2^12 - 1 symbols are raised to 1, so the most frequent ones can always give the excess back.
+    while (sum != total_frequency) {
+        const std::size_t largest = std::max_element(frequencies.begin(), frequencies.end()) - frequencies.begin();
+        if (sum < total_frequency) {
+            frequencies[largest] += total_frequency - sum;
+            sum = total_frequency;
+        } else {
+            const uint32_t decrease = std::min(sum - total_frequency, frequencies[largest] - 1);
+            frequencies[largest] -= decrease;
+            sum -= decrease;
+        }
+    }
+    return frequencies;
+}
+
+/**
+ * @brief Writes a frequency table: the bit lengths of the frequencies, then the bits below their top bits.
+ * @param bitset_writer Writer to emit bits.
+ * @param frequencies Frequency per symbol.
+ * @param count_bits Width of the symbol count.
+ */
+void write_frequencies(BitsetWriter &bitset_writer, const std::vector<uint32_t> &frequencies, uint32_t count_bits) {
+    std::vector<uint8_t> lengths(frequencies.size());
+    for (std::size_t symbol = 0; symbol < frequencies.size(); symbol++) {
+        lengths[symbol] = static_cast<uint8_t>(bit_length(frequencies[symbol]));
+    }
+    write_symbol_lengths(bitset_writer, lengths, count_bits);
+    for (std::size_t symbol = 0; symbol < frequencies.size(); symbol++) {
+        if (lengths[symbol] > 1) {
+            bitset_writer.write_bits(frequencies[symbol], lengths[symbol] - 1u);
+        }
+    }
+}
+
+/**
+ * @brief Reads a frequency table written by `write_frequencies()` and fills its slot lookup table.
+ * @param bitset_reader Reader positioned at the symbol count.
+ * @param alphabet_size Number of symbols of the alphabet.
+ * @param count_bits Width of the symbol count.
+ * @param table Table of 2^RANS_PROBABILITY_BITS entries to fill; entries of an unused table get frequency 0.
+ * @throws std::runtime_error if the frequencies do not sum to 2^RANS_PROBABILITY_BITS (or 0)
+ */
+void read_frequencies(BitsetReader &bitset_reader, std::size_t alphabet_size, uint32_t count_bits,
+                      std::vector<DecodeEntry> &table) {
+    const uint32_t total_frequency = uint32_t{1} << RANS_PROBABILITY_BITS;
+    const std::vector<uint8_t> lengths =
+        read_symbol_lengths(bitset_reader, alphabet_size, count_bits, RANS_PROBABILITY_BITS + 1);
+    table.assign(total_frequency, DecodeEntry());
+    uint32_t start = 0;
+    for (std::size_t symbol = 0; symbol < lengths.size(); symbol++) {
+        if (lengths[symbol] == 0) {
+            continue;
+        }
+        const uint32_t extra_bits = lengths[symbol] - 1u;
+        const uint32_t frequency =
+            (uint32_t{1} << extra_bits) | (extra_bits > 0 ? bitset_reader.read_bits(extra_bits) : 0);
+        if (frequency > total_frequency - start) {
+            throw std::runtime_error("Bad decompression format - bad entropy code table");
+        }
+        for (uint32_t slot = start; slot < start + frequency; slot++) {
+            table[slot].symbol = static_cast<uint16_t>(symbol);
+            table[slot].frequency = static_cast<uint16_t>(frequency);
+            table[slot].bias = static_cast<uint16_t>(slot - start);
+        }
+        start += frequency;
+    }
+    if (start != 0 && start != total_frequency) {
+        throw std::runtime_error("Bad decompression format - bad entropy code table");
+    }
+}
+
+/**
+ * @brief Codes recorded tokens into the bitstream, one block per ENTROPY_BLOCK_TOKENS tokens.
+ *
+ * rANS codes in reverse, so the symbols of a block are collected first and coded from the last one, and the bytes
+ * are reversed before they are written.
+ *
+ * @param bitset_writer Writer to emit bits; its geometry limits the alphabets.
+ * @param tokens Recorded tokens (see `BitsetWriter::record_token()`).
+ */
+void encode_tokens(BitsetWriter &bitset_writer, const std::vector<uint32_t> &tokens) {
+    const TokenGeometry &geometry = bitset_writer.get_geometry();
+    const std::size_t literal_length_size = literal_length_alphabet_size(geometry);
+    const std::size_t offset_size = geometry.offset_bits + 1;
+    std::vector<uint32_t> symbols; // Literal/length symbols; offset buckets are marked by RECORDED_MATCH_FLAG.
+    std::vector<uint8_t> bytes;
+
+    std::size_t begin = 0;
+    do {
+        const std::size_t end = std::min(tokens.size(), begin + ENTROPY_BLOCK_TOKENS);
+        std::vector<uint32_t> literal_length_frequencies(literal_length_size, 0);
+        std::vector<uint32_t> offset_frequencies(offset_size, 0);
+        const std::size_t block_size =
+            count_block_symbols(tokens, begin, end, literal_length_frequencies, offset_frequencies);
+        literal_length_frequencies = normalize_frequencies(literal_length_frequencies);
+        offset_frequencies = normalize_frequencies(offset_frequencies);
+        std::vector<uint32_t> literal_length_starts(literal_length_size + 1, 0);
+        std::vector<uint32_t> offset_starts(offset_size + 1, 0);
+        std::partial_sum(literal_length_frequencies.begin(), literal_length_frequencies.end(),
+                         literal_length_starts.begin() + 1);
+        std::partial_sum(offset_frequencies.begin(), offset_frequencies.end(), offset_starts.begin() + 1);
+
+        symbols.clear();
+        for (std::size_t i = begin; i < end; i++) {
+            const uint32_t token = tokens[i];
+            if (token & RECORDED_MATCH_FLAG) {
+                symbols.push_back(static_cast<uint32_t>(LITERAL_SYMBOL_COUNT + (token & 0xFF) - MIN_MATCH_LENGTH));
+                symbols.push_back(RECORDED_MATCH_FLAG | bit_length((token & ~RECORDED_MATCH_FLAG) >> 8));
+            } else {
+                symbols.push_back(token);
+            }
+        }
+
+        std::array<uint32_t, RANS_STATE_COUNT> states;
+        states.fill(RANS_STATE_LOWER_BOUND);
+        bytes.clear();
+        for (std::size_t i = symbols.size(); i > 0; i--) {
+            const uint32_t symbol = symbols[i - 1] & ~RECORDED_MATCH_FLAG;
+            const bool is_offset = (symbols[i - 1] & RECORDED_MATCH_FLAG) != 0;
+            const uint32_t frequency = is_offset ? offset_frequencies[symbol] : literal_length_frequencies[symbol];
+            const uint32_t start = is_offset ? offset_starts[symbol] : literal_length_starts[symbol];
+            uint32_t &state = states[(i - 1) % RANS_STATE_COUNT];
+            const uint32_t state_limit =
+                ((RANS_STATE_LOWER_BOUND >> RANS_PROBABILITY_BITS) << CHARACTER_SIZE_BITS) * frequency;
+            while (state >= state_limit) {
+                bytes.push_back(static_cast<uint8_t>(state));
+                state >>= CHARACTER_SIZE_BITS;
+            }
+            state = ((state / frequency) << RANS_PROBABILITY_BITS) + state % frequency + start;
+        }
+        // The decoder reads the states first, state 0 first and most significant byte first.
+        for (std::size_t i = RANS_STATE_COUNT; i > 0; i--) {
+            for (std::size_t byte = 0; byte < sizeof(uint32_t); byte++) {
+                bytes.push_back(static_cast<uint8_t>(states[i - 1] >> (CHARACTER_SIZE_BITS * byte)));
+            }
+        }
+        std::reverse(bytes.begin(), bytes.end());
+
+        bitset_writer.write_bits(end == tokens.size(), 1);
+        bitset_writer.write_bits(static_cast<uint32_t>(block_size), 32);
+        write_frequencies(bitset_writer, literal_length_frequencies, ENTROPY_LITERAL_LENGTH_COUNT_BITS);
+        write_frequencies(bitset_writer, offset_frequencies, ENTROPY_OFFSET_COUNT_BITS);
+        bitset_writer.write_bits(static_cast<uint32_t>(bytes.size()), 32);
+        bitset_writer.write_bits(0, static_cast<uint32_t>(-bitset_writer.get_bit_count() % CHARACTER_SIZE_BITS));
+        bitset_writer.write_bytes(bytes.data(), bytes.size());
+        for (std::size_t i = begin; i < end; i++) {
+            const uint32_t offset = (tokens[i] & ~RECORDED_MATCH_FLAG) >> 8;
+            const std::size_t bucket = bit_length(offset);
+            if ((tokens[i] & RECORDED_MATCH_FLAG) && bucket >= 2) {
+                bitset_writer.write_bits(offset, static_cast<uint32_t>(bucket - 1));
+            }
+        }
+        begin = end;
+    } while (begin < tokens.size());
+}
+
+/**
+ * @brief Decodes all blocks of a rANS coded token stream into the written data.
+ *
+ * The rANS bytes of a block are copied behind zero padding, so the per-token check of the read position covers
+ * the (at most two) bytes each of a token's two symbols reads. A block must leave every state where the encoder
+ * started it and use up its bytes exactly.
+ *
+ * @param bitset_reader Reader positioned at the first block.
+ * @param geometry Token geometry from the compression header.
+ * @param written_data Output the decoded bytes are appended to.
+ * @throws std::runtime_error if the stream is malformed
+ */
+void decode_tokens(BitsetReader &bitset_reader, const TokenGeometry &geometry, std::vector<uint8_t> &written_data) {
+    static const std::size_t STREAM_PADDING = 4; // Bytes a token may read past the end of a corrupt stream
+    const uint32_t slot_mask = (uint32_t{1} << RANS_PROBABILITY_BITS) - 1;
+    const std::size_t literal_length_size = literal_length_alphabet_size(geometry);
+    const std::size_t max_block_size = ENTROPY_BLOCK_TOKENS * (geometry.lookahead_size() - 1);
+    std::vector<DecodeEntry> literal_length_table;
+    std::vector<DecodeEntry> offset_table;
+    std::vector<uint8_t> stream;
+
+    bool is_last_block = false;
+    while (!is_last_block) {
+        is_last_block = bitset_reader.read_bits(1) == 1;
+        const std::size_t block_size = bitset_reader.read_bits(32);
+        if (block_size > max_block_size) {
+            throw std::runtime_error("Bad decompression format - bad rANS block size");
+        }
+        read_frequencies(bitset_reader, literal_length_size, ENTROPY_LITERAL_LENGTH_COUNT_BITS, literal_length_table);
+        read_frequencies(bitset_reader, geometry.offset_bits + 1, ENTROPY_OFFSET_COUNT_BITS, offset_table);
+        const std::size_t stream_size = bitset_reader.read_bits(32);
+        if (stream_size < RANS_STATE_COUNT * sizeof(uint32_t)) {
+            throw std::runtime_error("Bad decompression format - bad rANS stream");
+        }
+        const uint8_t *stream_bytes = bitset_reader.read_aligned_bytes(stream_size);
+        stream.assign(stream_bytes, stream_bytes + stream_size);
+        stream.resize(stream_size + STREAM_PADDING, 0);
+        const uint8_t *input = stream.data();
+        const uint8_t *const input_end = input + stream_size;
+
+        std::array<uint32_t, RANS_STATE_COUNT> states;
+        for (uint32_t &state : states) {
+            state = read_uint32_big_endian(input);
+            input += sizeof(uint32_t);
+            if (state < RANS_STATE_LOWER_BOUND) {
+                throw std::runtime_error("Bad decompression format - bad rANS stream");
+            }
+        }
+        // States stay at or above the lower bound, so each symbol reads at most two bytes.
+        std::size_t symbol_index = 0;
+        const auto decode_symbol = [&](const std::vector<DecodeEntry> &table) {
+            uint32_t &state = states[symbol_index++ % RANS_STATE_COUNT];
+            const DecodeEntry &entry = table[state & slot_mask];
+            if (entry.frequency == 0) {
+                throw std::runtime_error("Bad decompression format - bad rANS stream");
+            }
+            state = entry.frequency * (state >> RANS_PROBABILITY_BITS) + entry.bias;
+            while (state < RANS_STATE_LOWER_BOUND) {
+                state = (state << CHARACTER_SIZE_BITS) | *input++;
+            }
+            return entry;
+        };
+
+        const std::size_t written_size = written_data.size();
+        written_data.resize(written_size + block_size + MATCH_COPY_SLACK);
+        uint8_t *const output_begin = written_data.data();
+        uint8_t *output = output_begin + written_size;
+        uint8_t *const block_end = output + block_size;
+        while (output < block_end) {
+            if (input > input_end) {
+                throw std::runtime_error("Bad decompression format - bad rANS stream");
+            }
+            const DecodeEntry entry = decode_symbol(literal_length_table);
+            if (entry.symbol < LITERAL_SYMBOL_COUNT) {
+                *output++ = static_cast<uint8_t>(entry.symbol);
+                continue;
+            }
+            const std::size_t length = entry.symbol - LITERAL_SYMBOL_COUNT + MIN_MATCH_LENGTH;
+
+            const DecodeEntry offset_entry = decode_symbol(offset_table);
+            std::size_t offset = offset_entry.symbol;
+            if (offset >= 2) {
+                const auto extra_bits = static_cast<uint32_t>(offset - 1);
+                offset = (std::size_t{1} << extra_bits) | bitset_reader.read_bits(extra_bits);
+            }
+
+            if (offset >= static_cast<std::size_t>(output - output_begin) ||
+                length > static_cast<std::size_t>(block_end - output)) {
+                throw std::runtime_error("Invalid offset during decompression.");
+            }
+            copy_match(output, offset + 1, length);
+            output += length;
+        }
+        if (input != input_end ||
+            std::any_of(states.begin(), states.end(), [](uint32_t state) { return state != RANS_STATE_LOWER_BOUND; })) {
+            throw std::runtime_error("Bad decompression format - bad rANS stream");
+        }
+        written_data.resize(block_end - output_begin);
+    }
+}
+} // namespace RansCoder
+
+/**
+ * @namespace ArithmeticCoder
+ * @brief Context-modeled adaptive binary range coding of the LZ tokens (--entropy arithmetic).
+ *
+ * Every decision is a bit coded with an adaptive probability, as in LZMA: the token flag, the literal bits, the
+ * match length, whether a match repeats the previous offset, and otherwise the offset bucket and its extra bits.
+ * The probabilities are selected by the kinds of the two previous tokens and, for literals, by the high bits of the
+ * previous byte and of the byte one image row above (16 bytes back in adaptive mode, where blocks are 16 wide).
+ * They adapt over the whole stream, so no tables are stored.
+ *
+ * Blocks of up to ENTROPY_BLOCK_TOKENS tokens start with a last-block bit, the number of bytes they decode to
+ * (32 bits) and the number of range coded bytes (32 bits); the bytes follow from the next byte boundary.
+ */
+namespace ArithmeticCoder {
+using Probability = uint16_t; ///< Probability of a 0 bit in 1 / 2^ARITHMETIC_PROBABILITY_BITS units.
+
+/**
+ * @class RangeEncoder
+ * @brief LZMA-style range encoder: a 32-bit range over a 64-bit low that carries into the bytes already written.
+ */
+class RangeEncoder {
+  public:
+    /**
+     * @brief Codes a bit with an adaptive probability and moves the probability towards it.
+     * @param probability Probability of a 0 bit.
+     * @param bit Bit to code.
+     */
+    void encode_bit(Probability &probability, uint32_t bit) {
+        const uint32_t bound = (range >> ARITHMETIC_PROBABILITY_BITS) * probability;
+        if (bit == 0) {
+            range = bound;
+            probability += ((1u << ARITHMETIC_PROBABILITY_BITS) - probability) >> ARITHMETIC_ADAPTATION_SHIFT;
+        } else {
+            low += bound;
+            range -= bound;
+            probability -= probability >> ARITHMETIC_ADAPTATION_SHIFT;
+        }
+        while (range < ARITHMETIC_RANGE_TOP) {
+            range <<= CHARACTER_SIZE_BITS;
+            shift_low();
+        }
+    }
+
+    /**
+     * @brief Codes bits with a fixed probability of 1/2 (MSB first).
+     * @param value Bits to code.
+     * @param count Number of bits.
+     */
+    void encode_direct_bits(uint32_t value, uint32_t count) {
+        for (uint32_t i = count; i > 0; i--) {
+            range >>= 1;
+            low += range & (0 - ((value >> (i - 1)) & 1));
+            while (range < ARITHMETIC_RANGE_TOP) {
+                range <<= CHARACTER_SIZE_BITS;
+                shift_low();
+            }
+        }
+    }
+
+    /**
+     * @brief Flushes the state and hands out the coded bytes; the encoder starts over afterwards.
+     * @return Coded bytes.
+     */
+    std::vector<uint8_t> finish() {
+        for (std::size_t i = 0; i < sizeof(uint32_t) + 1; i++) {
+            shift_low();
+        }
+        std::vector<uint8_t> result;
+        result.swap(bytes);
+        *this = RangeEncoder();
+        return result;
+    }
+
+  private:
+    /**
+     * @brief Moves the top byte of `low` out, holding back 0xFF bytes a later carry may still change.
+     */
+    void shift_low() {
+        if (static_cast<uint32_t>(low) < 0xFF000000u || (low >> 32) != 0) {
+            const auto carry = static_cast<uint8_t>(low >> 32);
+            uint8_t byte = cache;
+            do {
+                bytes.push_back(static_cast<uint8_t>(byte + carry));
+                byte = 0xFF;
+            } while (--cache_size != 0);
+            cache = static_cast<uint8_t>(low >> 24);
+        }
+        cache_size++;
+        low = (low & 0x00FFFFFFu) << CHARACTER_SIZE_BITS;
+    }
+
+    uint64_t low = 0;            ///< Lower end of the interval; bit 32 is a pending carry.
+    uint32_t range = 0xFFFFFFFF; ///< Interval width.
+    uint8_t cache = 0;           ///< Byte held back until the carry into it is known.
+    std::size_t cache_size = 1;  ///< Held back bytes: `cache` and then 0xFF bytes.
+    std::vector<uint8_t> bytes;  ///< Coded bytes.
+};
+
+/**
+ * @class RangeDecoder
+ * @brief Decoder of the bytes of a RangeEncoder.
+ */
+class RangeDecoder {
+  public:
+    /**
+     * @brief Starts decoding a range coded byte sequence.
+     * @param begin First coded byte.
+     * @param end End of the coded bytes.
+     * @throws std::runtime_error if the bytes end first
+     */
+    RangeDecoder(const uint8_t *begin, const uint8_t *end) : next(begin), end(end) {
+        for (std::size_t i = 0; i < sizeof(uint32_t) + 1; i++) {
+            code = (code << CHARACTER_SIZE_BITS) | next_byte();
+        }
+    }
+
+    /**
+     * @brief Decodes a bit coded by `RangeEncoder::encode_bit()`, adapting the probability the same way.
+     * @param probability Probability of a 0 bit.
+     * @return The bit.
+     * @throws std::runtime_error if the bytes end first
+     */
+    uint32_t decode_bit(Probability &probability) {
+        const uint32_t bound = (range >> ARITHMETIC_PROBABILITY_BITS) * probability;
+        uint32_t bit;
+        if (code < bound) {
+            range = bound;
+            probability += ((1u << ARITHMETIC_PROBABILITY_BITS) - probability) >> ARITHMETIC_ADAPTATION_SHIFT;
+            bit = 0;
+        } else {
+            code -= bound;
+            range -= bound;
+            probability -= probability >> ARITHMETIC_ADAPTATION_SHIFT;
+            bit = 1;
+        }
+        if (range < ARITHMETIC_RANGE_TOP) {
+            range <<= CHARACTER_SIZE_BITS;
+            code = (code << CHARACTER_SIZE_BITS) | next_byte();
+        }
+        return bit;
+    }
+
+    /**
+     * @brief Decodes bits coded by `RangeEncoder::encode_direct_bits()`.
+     * @param count Number of bits.
+     * @return The bits (MSB first).
+     * @throws std::runtime_error if the bytes end first
+     */
+    uint32_t decode_direct_bits(uint32_t count) {
+        uint32_t value = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            range >>= 1;
+            const uint32_t bit = code >= range;
+            code -= range & (0 - bit);
+            value = (value << 1) | bit;
+            if (range < ARITHMETIC_RANGE_TOP) {
+                range <<= CHARACTER_SIZE_BITS;
+                code = (code << CHARACTER_SIZE_BITS) | next_byte();
+            }
+        }
+        return value;
+    }
+
+    /**
+     * @brief Checks that all coded bytes were used.
+     * @return True if the decoder read exactly the encoder's bytes.
+     */
+    bool is_at_end() const { return next == end; }
+
+  private:
+    /**
+     * @brief Takes the next coded byte.
+     * @return The byte.
+     * @throws std::runtime_error if the bytes ended
+     */
+    uint8_t next_byte() {
+        if (next == end) {
+            throw std::runtime_error("Bad decompression format - bad range coded stream");
+        }
+        return *next++;
+    }
+
+    const uint8_t *next;         ///< Next coded byte.
+    const uint8_t *end;          ///< End of the coded bytes.
+    uint32_t range = 0xFFFFFFFF; ///< Interval width.
+    uint32_t code = 0;           ///< Position of the coded value within the interval.
+};
+
+/**
+ * @struct Model
+ * @brief Adaptive probabilities and token history shared by the encoder and the decoder.
+ */
+struct Model {
+    /**
+     * @brief Creates a model with all bit values equally likely.
+     * @param geometry Token geometry, which sizes the length and offset models.
+     * @param row_distance Distance of the byte one image row above.
+     */
+    Model(const TokenGeometry &geometry, std::size_t row_distance)
+        : length_bits(static_cast<uint32_t>(geometry.length_bits)), row_distance(row_distance),
+          literals(std::size_t{1} << (2 * ARITHMETIC_LITERAL_CONTEXT_BITS + CHARACTER_SIZE_BITS),
+                   ARITHMETIC_HALF_PROBABILITY),
+          lengths(ARITHMETIC_STATE_COUNT << geometry.length_bits, ARITHMETIC_HALF_PROBABILITY),
+          buckets(ARITHMETIC_LENGTH_CONTEXT_COUNT << ARITHMETIC_BUCKET_BITS, ARITHMETIC_HALF_PROBABILITY),
+          offsets((MAX_OFFSET_SIZE_BITS + 1) << ARITHMETIC_MODELED_OFFSET_BITS, ARITHMETIC_HALF_PROBABILITY) {
+        is_match.fill(ARITHMETIC_HALF_PROBABILITY);
+        is_repeat.fill(ARITHMETIC_HALF_PROBABILITY);
+    }
+
+    /**
+     * @brief Literal probabilities for the byte at a position of the stream.
+     * @param data First byte of the stream.
+     * @param position Position of the literal.
+     * @return First of the 256 probabilities of the literal's bit tree.
+     */
+    Probability *literal_context(const uint8_t *data, std::size_t position) {
+        const uint32_t previous = position > 0 ? data[position - 1] : 0;
+        const uint32_t above = position >= row_distance ? data[position - row_distance] : 0;
+        const uint32_t shift = CHARACTER_SIZE_BITS - ARITHMETIC_LITERAL_CONTEXT_BITS;
+        const std::size_t context = (previous >> shift) << ARITHMETIC_LITERAL_CONTEXT_BITS | (above >> shift);
+        return &literals[context << CHARACTER_SIZE_BITS];
+    }
+
+    /**
+     * @brief Records the kind of a coded token.
+     * @param is_match_token Whether the token was a match.
+     */
+    void update_state(bool is_match_token) { state = ((state << 1) | is_match_token) % ARITHMETIC_STATE_COUNT; }
+
+    uint32_t length_bits;                                      ///< Width of the match length values.
+    std::size_t row_distance;                                  ///< Distance of the byte one image row above.
+    std::size_t state = 0;                                     ///< Kinds of the two previous tokens (bit = match).
+    uint32_t last_offset = UINT32_MAX;                         ///< Offset of the previous match (none yet).
+    std::array<Probability, ARITHMETIC_STATE_COUNT> is_match;  ///< Token flag per state.
+    std::array<Probability, ARITHMETIC_STATE_COUNT> is_repeat; ///< Repeated offset flag per state.
+    std::vector<Probability> literals;                         ///< Literal bit trees per previous / above context.
+    std::vector<Probability> lengths;                          ///< Match length bit trees per state.
+    std::vector<Probability> buckets;                          ///< Offset bucket bit trees per length context.
+    std::vector<Probability> offsets;                          ///< Bit trees of the top extra bits per bucket.
+};
+
+/**
+ * @brief Codes a value with a bit tree of probabilities (MSB first, each bit in the context of the bits before).
+ * @param encoder Range encoder.
+ * @param probabilities Tree of 2^count probabilities (index 0 unused).
+ * @param count Number of bits.
+ * @param value Value to code.
+ */
+void encode_tree(RangeEncoder &encoder, Probability *probabilities, uint32_t count, uint32_t value) {
+    uint32_t node = 1;
+    for (uint32_t i = count; i > 0; i--) {
+        const uint32_t bit = (value >> (i - 1)) & 1;
+        encoder.encode_bit(probabilities[node], bit);
+        node = (node << 1) | bit;
+    }
+}
+
+/**
+ * @brief Decodes a value coded by `encode_tree()`.
+ * @param decoder Range decoder.
+ * @param probabilities Tree of 2^count probabilities (index 0 unused).
+ * @param count Number of bits.
+ * @return The value.
+ */
+uint32_t decode_tree(RangeDecoder &decoder, Probability *probabilities, uint32_t count) {
+    uint32_t node = 1;
+    for (uint32_t i = 0; i < count; i++) {
+        node = (node << 1) | decoder.decode_bit(probabilities[node]);
+    }
+    return node - (uint32_t{1} << count);
+}
+
+/**
+ * @brief Offset bucket context of a match length.
+ * @param length Match length.
+ * @return Context index below ARITHMETIC_LENGTH_CONTEXT_COUNT.
+ */
+std::size_t length_context(std::size_t length) {
+    return std::min(length - MIN_MATCH_LENGTH, ARITHMETIC_LENGTH_CONTEXT_COUNT - 1);
+}
+
+/**
+ * @brief Distance of the byte one image row above in a token stream.
+ * @param is_adaptive Whether the stream holds adaptive 16x16 blocks.
+ * @param width Image width from the compression header.
+ * @return Distance in bytes (at least 1).
+ */
+std::size_t context_row_distance(bool is_adaptive, unsigned width) {
+    return is_adaptive ? ADAPTIVE_BLOCK_WIDTH : std::max(width & 0xFFFFu, 1u);
+}
+
+/**
+ * @brief Codes recorded tokens into the bitstream, one block per ENTROPY_BLOCK_TOKENS tokens.
+ *
+ * The stream is rebuilt from the tokens as they are coded, so the literal contexts see the same bytes as the
+ * decoder.
+ *
+ * @param bitset_writer Writer to emit bits; its geometry limits the alphabets.
+ * @param tokens Recorded tokens (see `BitsetWriter::record_token()`).
+ * @param row_distance Distance of the byte one image row above (see `context_row_distance()`).
+ */
+void encode_tokens(BitsetWriter &bitset_writer, const std::vector<uint32_t> &tokens, std::size_t row_distance) {
+    Model model(bitset_writer.get_geometry(), row_distance);
+    RangeEncoder encoder;
+    std::vector<uint8_t> data;
+
+    std::size_t begin = 0;
+    do {
+        const std::size_t end = std::min(tokens.size(), begin + ENTROPY_BLOCK_TOKENS);
+        const std::size_t block_begin = data.size();
+        for (std::size_t i = begin; i < end; i++) {
+            const uint32_t token = tokens[i];
+            const bool is_match_token = (token & RECORDED_MATCH_FLAG) != 0;
+            encoder.encode_bit(model.is_match[model.state], is_match_token);
+            if (!is_match_token) {
+                encode_tree(encoder, model.literal_context(data.data(), data.size()), CHARACTER_SIZE_BITS, token);
+                data.push_back(static_cast<uint8_t>(token));
+                model.update_state(false);
+                continue;
+            }
+
+            const std::size_t length = token & 0xFF;
+            const uint32_t offset = (token & ~RECORDED_MATCH_FLAG) >> 8;
+            encode_tree(encoder, &model.lengths[model.state << model.length_bits], model.length_bits,
+                        static_cast<uint32_t>(length - MIN_MATCH_LENGTH));
+            encoder.encode_bit(model.is_repeat[model.state], offset == model.last_offset);
+            if (offset != model.last_offset) {
+                const auto bucket = static_cast<uint32_t>(bit_length(offset));
+                Probability *buckets = &model.buckets[length_context(length) << ARITHMETIC_BUCKET_BITS];
+                encode_tree(encoder, buckets, ARITHMETIC_BUCKET_BITS, bucket);
+                if (bucket >= 2) {
+                    const uint32_t extra_bits = bucket - 1;
+                    const uint32_t modeled_bits = std::min(extra_bits, ARITHMETIC_MODELED_OFFSET_BITS);
+                    const uint32_t direct_bits = extra_bits - modeled_bits;
+                    encode_tree(encoder, &model.offsets[bucket << ARITHMETIC_MODELED_OFFSET_BITS], modeled_bits,
+                                (offset >> direct_bits) & ((1u << modeled_bits) - 1));
+                    encoder.encode_direct_bits(offset & ((1u << direct_bits) - 1), direct_bits);
+                }
+                model.last_offset = offset;
+            }
+            for (std::size_t j = 0; j < length; j++) {
+                data.push_back(data[data.size() - offset - 1]);
+            }
+            model.update_state(true);
+        }
+
+        const std::vector<uint8_t> bytes = encoder.finish();
+        bitset_writer.write_bits(end == tokens.size(), 1);
+        bitset_writer.write_bits(static_cast<uint32_t>(data.size() - block_begin), 32);
+        bitset_writer.write_bits(static_cast<uint32_t>(bytes.size()), 32);
+        bitset_writer.write_bits(0, static_cast<uint32_t>(-bitset_writer.get_bit_count() % CHARACTER_SIZE_BITS));
+        bitset_writer.write_bytes(bytes.data(), bytes.size());
+        begin = end;
+    } while (begin < tokens.size());
+}
+
+/**
+ * @brief Decodes all blocks of a range coded token stream into the written data.
+ * @param bitset_reader Reader positioned at the first block.
+ * @param geometry Token geometry from the compression header.
+ * @param row_distance Distance of the byte one image row above (see `context_row_distance()`).
+ * @param written_data Output the decoded bytes are appended to.
+ * @throws std::runtime_error if the stream is malformed
+ */
+void decode_tokens(BitsetReader &bitset_reader, const TokenGeometry &geometry, std::size_t row_distance,
+                   std::vector<uint8_t> &written_data) {
+    const std::size_t max_block_size = ENTROPY_BLOCK_TOKENS * (geometry.lookahead_size() - 1);
+    const std::size_t stream_begin = written_data.size();
+    Model model(geometry, row_distance);
+
+    bool is_last_block = false;
+    while (!is_last_block) {
+        is_last_block = bitset_reader.read_bits(1) == 1;
+        const std::size_t block_size = bitset_reader.read_bits(32);
+        if (block_size > max_block_size) {
+            throw std::runtime_error("Bad decompression format - bad range coded block size");
+        }
+        const std::size_t coded_size = bitset_reader.read_bits(32);
+        const uint8_t *coded_bytes = bitset_reader.read_aligned_bytes(coded_size);
+        RangeDecoder decoder(coded_bytes, coded_bytes + coded_size);
+
+        const std::size_t written_size = written_data.size();
+        written_data.resize(written_size + block_size + MATCH_COPY_SLACK);
+        uint8_t *const stream = written_data.data() + stream_begin;
+        uint8_t *output = written_data.data() + written_size;
+        uint8_t *const block_end = output + block_size;
+        while (output < block_end) {
+            if (decoder.decode_bit(model.is_match[model.state]) == 0) {
+                Probability *literals = model.literal_context(stream, output - stream);
+                *output++ = static_cast<uint8_t>(decode_tree(decoder, literals, CHARACTER_SIZE_BITS));
+                model.update_state(false);
+                continue;
+            }
+
+            const std::size_t length =
+                decode_tree(decoder, &model.lengths[model.state << model.length_bits], model.length_bits) +
+                MIN_MATCH_LENGTH;
+            if (decoder.decode_bit(model.is_repeat[model.state]) == 0) {
+                Probability *buckets = &model.buckets[length_context(length) << ARITHMETIC_BUCKET_BITS];
+                const uint32_t bucket = decode_tree(decoder, buckets, ARITHMETIC_BUCKET_BITS);
+                if (bucket > geometry.offset_bits) {
+                    throw std::runtime_error("Invalid offset during decompression.");
+                }
+                uint32_t offset = bucket;
+                if (bucket >= 2) {
+                    const uint32_t extra_bits = bucket - 1;
+                    const uint32_t modeled_bits = std::min(extra_bits, ARITHMETIC_MODELED_OFFSET_BITS);
+                    const uint32_t direct_bits = extra_bits - modeled_bits;
+                    const uint32_t high = decode_tree(decoder, &model.offsets[bucket << ARITHMETIC_MODELED_OFFSET_BITS],
+                                                      modeled_bits);
+                    offset = (((1u << modeled_bits) | high) << direct_bits) | decoder.decode_direct_bits(direct_bits);
+                }
+                model.last_offset = offset;
+            }
+
+            const std::size_t offset = model.last_offset;
+            if (offset >= static_cast<std::size_t>(output - stream) ||
+                length > static_cast<std::size_t>(block_end - output)) {
+                throw std::runtime_error("Invalid offset during decompression.");
+            }
+            copy_match(output, offset + 1, length);
+            output += length;
+            model.update_state(true);
+        }
+        if (!decoder.is_at_end()) {
+            throw std::runtime_error("Bad decompression format - bad range coded stream");
+        }
+        written_data.resize(block_end - written_data.data());
+    }
+}
+} // namespace ArithmeticCoder
+
+/**
+ * @namespace StaticProcessor
+ * @brief Contains compression and decompression logic for static (sequential) mode.
+ *
+ * The token encoders and decoders are shared with the adaptive mode.
+ */
+namespace StaticProcessor {
+/**
+ * @brief Writes a match token (flag bit, offset and length) into the bitstream.
+ *
+ * The fields are packed into one word with the widths of the writer's token geometry and written at once. With an
+ * entropy coder the match is only recorded.
+ *
+ * @param match The LZ match data (offset, length).
+ * @param bitset_writer Writer to emit compressed bits into the output stream.
+ */
+void write_match_token(const lz_match &match, BitsetWriter &bitset_writer) {
+    const TokenGeometry &geometry = bitset_writer.get_geometry();
+    bitset_writer.count_match_token(match);
+    if (bitset_writer.is_recording()) {
+        bitset_writer.record_token(RECORDED_MATCH_FLAG | static_cast<uint32_t>(match.offset << 8 | match.length));
+        return;
+    }
+    const uint32_t token = (uint32_t{1} << (geometry.offset_bits + geometry.length_bits)) |
+                           (static_cast<uint32_t>(match.offset) << geometry.length_bits) |
+                           static_cast<uint32_t>(match.length);
+    bitset_writer.write_bits(token, static_cast<uint32_t>(geometry.match_token_bits()));
+}
+
+/**
+ * @brief Writes a literal token (flag bit and two characters) into the bitstream.
+ *
+ * Only the last token of a stream may carry a single character; the decoder stops at the end of the data. With an
+ * entropy coder the characters are only recorded.
+ *
+ * @param literals Characters to write.
+ * @param count Number of characters (2, or 1 at the end of the stream).
+ * @param bitset_writer Writer to emit bits.
+ */
+void write_literal_token(const uint8_t *literals, std::size_t count, BitsetWriter &bitset_writer) {
+    bitset_writer.count_literal_token(count);
+    if (bitset_writer.is_recording()) {
+        for (std::size_t i = 0; i < count; i++) {
+            bitset_writer.record_token(literals[i]);
+        }
+        return;
+    }
+    bitset_writer.write_bits(0, FLAG_SIZE_BITS);
+    for (std::size_t i = 0; i < count; i++) {
+        bitset_writer.write_bits(literals[i], CHARACTER_SIZE_BITS);
+    }
+}
+
+/**
+ * @brief Writes compressed (match) token using BitsetWriter and updates buffers.
+ *
+ * Writes a flag bit, match offset, and match length into the bitstream.
+ * Then updates buffers based on the match length.
+ *
+ * @tparam Finder Match finder the buffers are configured with (see `Buffer::active_match_finder()`).
+ * @param buffers Buffers positioned at the match.
+ * @param match The LZ match data (offset, length).
+ * @param bitset_writer Writer to emit compressed bits into the output stream.
+ */
+template <MatchFinderType Finder>
+void compress_compressed(Buffer &buffers, const lz_match &match, BitsetWriter &bitset_writer) {
+    write_match_token(match, bitset_writer);
+
+    // Update buffers
+    buffers.advance<Finder>(match.length);
+}
+
+/**
+ * @brief Writes literal characters as uncompressed tokens into the output.
+ *
+ * Emits two characters as literal tokens with a flag and 8-bit encoding each.
+ * Advances buffers accordingly.
+ *
+ * @tparam Finder Match finder the buffers are configured with (see `Buffer::active_match_finder()`).
+ * @param buffers Buffers pointing at the stream being compressed.
+ * @param bitset_writer Writer to emit bits.
+ */
+template <MatchFinderType Finder> void compress_literal(Buffer &buffers, BitsetWriter &bitset_writer) {
+    const std::size_t count = std::min<std::size_t>(2, buffers.lookahead_size());
+    write_literal_token(buffers.lookahead(), count, bitset_writer);
+    buffers.advance<Finder>(count);
+}
+
+/**
+ * @brief Encodes the stream the buffers point to by taking the longest match at each position.
+ *
+ * @tparam Finder Match finder the buffers are configured with (see `Buffer::active_match_finder()`).
+ * @param buffers Buffers pointing at the stream being compressed.
+ * @param bitset_writer Writer to emit bits.
+ */
+template <MatchFinderType Finder> void compress_greedy(Buffer &buffers, BitsetWriter &bitset_writer) {
+    int tmp_i = 0;
+    while (buffers.lookahead_size() > 0) {
+        tmp_i++;
+        lz_match match = buffers.find_match<Finder>();
+
+        if (DEBUG_SHIFTING_BUFFERS_AND_READ_NEW_CHAR) {
+            buffers.debug_print_buffers("==Before shifting buffers and reading new char | tmp_i: " +
+                                         std::to_string(tmp_i));
+        }
+
+        if (match.found) {
+            compress_compressed<Finder>(buffers, match, bitset_writer);
+        } else {
+            compress_literal<Finder>(buffers, bitset_writer);
+        }
+
+        if (DEBUG_SHIFTING_BUFFERS_AND_READ_NEW_CHAR) {
+            buffers.debug_print_buffers("==After shifting buffers and reading new char | tmp_i: " +
+                                         std::to_string(tmp_i));
+        }
+    }
+}
+
+/**
+ * @brief Encodes the stream the buffers point to with lazy match evaluation.
+ *
+ * zlib and zstd check whether a longer match starts at i+1 or i+2 before committing to the match at i and emit a
+ * literal if so. Literals are always coded in pairs here, so instead the end of the current match is moved: before
+ * committing to a match of length L, the matches starting at i+L-1 (and, with two steps, i+L-2) are searched as well
+ * and the match is shortened by one or two bytes when the following token then reaches further. Both choices cost
+ * two tokens, so the longer reach wins. Positions searched ahead are cached, so each is searched at most once.
+ *
+ * @tparam Finder Match finder the buffers are configured with (see `Buffer::active_match_finder()`).
+ * @param buffers Buffers pointing at the stream being compressed.
+ * @param bitset_writer Writer to emit bits.
+ * @param steps How many bytes the match may be shortened by (1 or 2).
+ */
+template <MatchFinderType Finder>
+void compress_lazy(Buffer &buffers, BitsetWriter &bitset_writer, std::size_t steps) {
+    const uint8_t *data = buffers.data;
+    const std::size_t size = buffers.data_size;
+
+    // Searched positions stay within one maximum match length of the current token.
+    std::vector<lz_match> searched(buffers.max_lookahead_size + steps);
+    auto match_at = [&](std::size_t stream_position) {
+        if (buffers.position < stream_position) {
+            buffers.advance<Finder>(stream_position - buffers.position);
+        }
+        while (buffers.position <= stream_position) {
+            searched[buffers.position % searched.size()] = buffers.find_match<Finder>();
+            buffers.advance<Finder>(1);
+        }
+        return searched[stream_position % searched.size()];
+    };
+    // Bytes the token starting at `stream_position` codes (a literal pair when there is no match).
+    auto reach_at = [&](std::size_t stream_position) {
+        if (stream_position >= size) {
+            return std::size_t{0};
+        }
+        const lz_match next = match_at(stream_position);
+        return next.found ? next.length : std::min<std::size_t>(2, size - stream_position);
+    };
+
+    std::size_t position = 0;
+    while (position < size) {
+        lz_match match = match_at(position);
+        if (!match.found) {
+            const std::size_t count = std::min<std::size_t>(2, size - position);
+            write_literal_token(data + position, count, bitset_writer);
+            position += count;
+            continue;
+        }
+
+        // Candidates are searched in stream order so that every position after the first one is cached; on a tie
+        // the longer match wins.
+        const std::size_t shortest = std::max(match.length - std::min(steps, match.length), MIN_MATCH_LENGTH);
+        std::size_t best_length = 0;
+        std::size_t best_reach = 0;
+        for (std::size_t length = shortest; length <= match.length; length++) {
+            const std::size_t reach = length + reach_at(position + length);
+            if (reach >= best_reach) {
+                best_reach = reach;
+                best_length = length;
+            }
+        }
+
+        match.length = best_length;
+        write_match_token(match, bitset_writer);
+        position += match.length;
+    }
+}
+
+/**
+ * @brief Encodes the stream the buffers point to with the fewest bits the token format allows.
+ *
+ * The longest match is collected at every position first. Every token has a fixed price (the match token size of
+ * the geometry for any match, LITERAL_TOKEN_BITS for a literal pair) and every prefix of a match is itself a valid
+ * match, so the cheapest encoding of each suffix follows from the suffixes after it: a backward dynamic programming
+ * pass over the positions finds the optimal parse for the available matches. The bitstream format is unchanged.
+ *
+ * @tparam Finder Match finder the buffers are configured with (see `Buffer::active_match_finder()`).
+ * @param buffers Buffers pointing at the stream being compressed.
+ * @param bitset_writer Writer to emit bits.
+ */
+template <MatchFinderType Finder> void compress_optimal(Buffer &buffers, BitsetWriter &bitset_writer) {
+    const uint8_t *data = buffers.data;
+    const std::size_t size = buffers.data_size;
+
+    const std::size_t match_token_bits = bitset_writer.get_geometry().match_token_bits();
+    std::vector<lz_match> matches(size);
+    while (buffers.lookahead_size() > 0) {
+        matches[buffers.position] = buffers.find_match<Finder>();
+        buffers.advance<Finder>(1);
+    }
+
+    // price[i] = bits needed for data[i..size), step[i] = length of the first token on that path (0 = literals).
+    std::vector<std::size_t> price(size + 1, 0);
+    std::vector<uint8_t> step(size + 1, 0);
+    if (size > 0) {
+        price[size - 1] = FLAG_SIZE_BITS + CHARACTER_SIZE_BITS; // A single trailing literal ends the stream.
+    }
+    for (std::size_t end = size; end >= 2; end--) {
+        const std::size_t i = end - 2;
+        price[i] = LITERAL_TOKEN_BITS + price[i + 2];
+        if (matches[i].found) {
+            for (std::size_t length = MIN_MATCH_LENGTH; length <= matches[i].length; length++) {
+                const std::size_t match_price = match_token_bits + price[i + length];
+                if (match_price < price[i]) {
+                    price[i] = match_price;
+                    step[i] = static_cast<uint8_t>(length);
+                }
+            }
+        }
+    }
+
+    std::size_t position = 0;
+    while (position < size) {
+        if (step[position] != 0) {
+            lz_match match = matches[position];
+            match.length = step[position];
+            write_match_token(match, bitset_writer);
+            position += match.length;
+        } else {
+            const std::size_t count = std::min<std::size_t>(2, size - position);
+            write_literal_token(data + position, count, bitset_writer);
+            position += count;
+        }
+    }
+}
+
+/**
+ * @brief Codes the tokens a writer recorded for an entropy coder (nothing to do for raw tokens).
+ * @param codec State of the current codec call (entropy coder, image width and mode).
+ * @param bitset_writer Writer that recorded the tokens of one stream.
+ */
+void encode_recorded_tokens(Codec &codec, BitsetWriter &bitset_writer) {
+    if (!bitset_writer.is_recording()) {
+        return;
+    }
+    const std::size_t bit_count = bitset_writer.get_bit_count();
+    switch (codec.options.entropy) {
+    case EntropyCoder::RANS:
+        RansCoder::encode_tokens(bitset_writer, bitset_writer.take_recorded_tokens());
+        break;
+    case EntropyCoder::ARITHMETIC:
+        ArithmeticCoder::encode_tokens(bitset_writer, bitset_writer.take_recorded_tokens(),
+                                       ArithmeticCoder::context_row_distance(
+                                           codec.options.is_adaptive, static_cast<unsigned>(codec.get_width())));
+        break;
+    default:
+        HuffmanCoder::encode_tokens(bitset_writer, bitset_writer.take_recorded_tokens());
+        break;
+    }
+    bitset_writer.count_coded_bits(bitset_writer.get_bit_count() - bit_count);
+}
+
+/**
+ * @brief Encodes the stream the buffers point to with the parse mode selected by --parse.
+ *
+ * The parse mode and the match finder are resolved here once per stream; each combination runs its own
+ * specialized loop. Tokens recorded for an entropy coder are coded at the end, so the writer's size is final.
+ *
+ * @param codec State of the current codec call.
+ * @param buffers Buffers pointing at the stream being compressed.
+ * @param bitset_writer Writer to emit bits.
+ */
+void compress_stream(Codec &codec, Buffer &buffers, BitsetWriter &bitset_writer) {
+    const ParseMode parse_mode = codec.get_parse_mode();
+    buffers.dispatch_match_finder([&](auto finder) {
+        constexpr MatchFinderType Finder = decltype(finder)::value;
+        switch (parse_mode) {
+        case ParseMode::OPTIMAL:
+            compress_optimal<Finder>(buffers, bitset_writer);
+            break;
+        case ParseMode::LAZY:
+            compress_lazy<Finder>(buffers, bitset_writer, 1);
+            break;
+        case ParseMode::LAZY2:
+            compress_lazy<Finder>(buffers, bitset_writer, 2);
+            break;
+        default:
+            compress_greedy<Finder>(buffers, bitset_writer);
+            break;
+        }
+    });
+
+    encode_recorded_tokens(codec, bitset_writer);
+}
+
+/**
+ * @brief Compressed form of one chunk of a container.
+ */
+struct CompressedChunk {
+    std::vector<uint8_t> bytes; ///< Token stream, or the raw chunk when stored.
+    uint32_t padding_bits = 0;  ///< Zero bits padding the last byte of the token stream.
+    bool is_stored = false;     ///< Whether the chunk is copied uncompressed (its tokens were not smaller).
+    Stats tokens;               ///< Counts of the chunk's tokens (only with --stats).
+
+    /**
+     * @brief Chunk table entry: `compressed size << CHUNK_FLAG_BITS | stored << 3 | padding bits`.
+     * @return Entry word.
+     */
+    uint32_t get_table_entry() const {
+        const uint32_t flags = (static_cast<uint32_t>(is_stored) << 3) | padding_bits;
+        return static_cast<uint32_t>(bytes.size() << CHUNK_FLAG_BITS) | flags;
+    }
+};
+
+/**
+ * @brief Cheaply predicts that LZSS coding cannot make a stream smaller, so the full pass can be skipped.
+ *
+ * INCOMPRESSIBLE_PROBE_COUNT samples of INCOMPRESSIBLE_PROBE_SIZE bytes spread over the stream are coded greedily
+ * with a single-probe hash (like level 1, with matches only inside a sample). The stream counts as incompressible
+ * only if the samples together come out at least as large as they are, i.e. when hardly any 3-byte repeat
+ * exists (noise, already compressed or encrypted data). Streams shorter than all samples together are never
+ * skipped. Literals are priced at their raw width, so the probe only applies to `EntropyCoder::RAW`: an entropy
+ * coder can still shrink streams with a skewed byte distribution that has no repeats.
+ *
+ * @param data First byte of the stream.
+ * @param size Size of the stream.
+ * @param geometry Token geometry the stream would be coded with.
+ * @return true if the stream should be stored raw without an LZ pass
+ */
+bool is_clearly_incompressible(const uint8_t *data, std::size_t size, const TokenGeometry &geometry) {
+    const std::size_t sample_size = INCOMPRESSIBLE_PROBE_SIZE;
+    if (size < INCOMPRESSIBLE_PROBE_COUNT * sample_size) {
+        return false;
+    }
+
+    const std::size_t max_lookahead_size = geometry.lookahead_size();
+    std::vector<uint32_t> hash_head(std::size_t{1} << INCOMPRESSIBLE_PROBE_HASH_BITS);
+    std::size_t coded_bits = 0;
+    for (std::size_t sample = 0; sample < INCOMPRESSIBLE_PROBE_COUNT; sample++) {
+        const uint8_t *sample_data = data + (size - sample_size) * sample / (INCOMPRESSIBLE_PROBE_COUNT - 1);
+        // Heads store position + 1, so 0 marks an empty slot.
+        std::fill(hash_head.begin(), hash_head.end(), 0);
+        std::size_t position = 0;
+        while (position < sample_size) {
+            const std::size_t lookahead = std::min(sample_size - position, max_lookahead_size);
+            std::size_t length = 0;
+            if (lookahead >= MIN_MATCH_LENGTH) {
+                const uint8_t *prefix = sample_data + position;
+                const uint32_t key = (static_cast<uint32_t>(prefix[0]) << 16) |
+                                     (static_cast<uint32_t>(prefix[1]) << 8) | prefix[2];
+                const uint32_t hash = (key * 2654435761u) >> (32 - INCOMPRESSIBLE_PROBE_HASH_BITS);
+                const std::size_t candidate = hash_head[hash];
+                const std::size_t distance = position + 1 - candidate;
+                if (candidate != 0) {
+                    length = match_length(prefix - distance, prefix, std::min(distance, lookahead - 1));
+                }
+                // Matches may not overlap, so within runs the head is kept until it is a full match length back.
+                if (candidate == 0 || distance > max_lookahead_size) {
+                    hash_head[hash] = static_cast<uint32_t>(position + 1);
+                }
+            }
+            if (length >= MIN_MATCH_LENGTH) {
+                coded_bits += geometry.match_token_bits();
+                position += length;
+            } else {
+                coded_bits += LITERAL_TOKEN_BITS;
+                position += 2;
+            }
+        }
+    }
+    return coded_bits >= INCOMPRESSIBLE_PROBE_COUNT * sample_size * CHARACTER_SIZE_BITS;
+}
+
+/**
+ * @brief Compresses one chunk of a container on its own (empty window at its start).
+ *
+ * @param codec State of the current codec call.
+ * @param buffers Window and match finder state owned by the calling worker.
+ * @param data First byte of the chunk.
+ * @param size Size of the chunk.
+ * @param chunk Receives the token stream, or the raw chunk if the tokens are not smaller.
+ */
+void compress_chunk(Codec &codec, Buffer &buffers, const uint8_t *data, std::size_t size,
+                    CompressedChunk &chunk) {
+    chunk.padding_bits = 0;
+    chunk.tokens = Stats();
+    chunk.is_stored =
+        codec.options.entropy == EntropyCoder::RAW && is_clearly_incompressible(data, size, codec.geometry);
+    if (chunk.is_stored) {
+        chunk.bytes.assign(data, data + size);
+        return;
+    }
+
+    BitsetWriter bitset_writer(codec, size);
+
+    std::unique_ptr<SuffixArrayMatchFinder> suffix_array_matches;
+    if (codec.is_suffix_array()) {
+        PhaseTimer timer(codec, "suffix_array");
+        suffix_array_matches = std::make_unique<SuffixArrayMatchFinder>(data, size, codec.geometry);
+    }
+    buffers.reset(data, size);
+    buffers.precomputed_matches = suffix_array_matches.get();
+    {
+        PhaseTimer timer(codec, "encode");
+        compress_stream(codec, buffers, bitset_writer);
+        bitset_writer.flush();
+    }
+
+    chunk.is_stored = bitset_writer.get_flushed_bytes().size() >= size;
+    chunk.padding_bits = 0;
+    if (chunk.is_stored) {
+        chunk.bytes.assign(data, data + size);
+    } else {
+        chunk.bytes = bitset_writer.get_flushed_bytes();
+        chunk.padding_bits = static_cast<uint32_t>(bitset_writer.get_final_padding_bits());
+        if (const Stats *tokens = bitset_writer.get_token_stats()) {
+            chunk.tokens = *tokens;
+        }
+    }
+}
+
+/**
+ * @brief Compresses the input as a container of independent chunks (--chunk-size).
+ *
+ * The input is split into chunks of `Codec::get_chunk_size()` bytes (the last may be shorter) and every chunk
+ * is compressed on its own on a pool of `Codec::get_thread_count()` workers. Each worker owns a copy of the
+ * buffers (and a suffix array per chunk with -s). The split does not depend on the thread count, so neither does
+ * the output.
+ *
+ * Container layout after the header (big-endian 32-bit words): chunk size, chunk count and one table entry per
+ * chunk (CompressedChunk::get_table_entry()), followed by the chunk bytes in order.
+ *
+ * @param codec State of the current codec call.
+ */
+void compress_chunks(Codec &codec) {
+    const File *files = codec.files;
+    const std::size_t chunk_size = codec.get_chunk_size();
+    const std::size_t chunk_count = (files->buffer_size + chunk_size - 1) / chunk_size;
+    const std::size_t thread_count = std::min(codec.get_thread_count(), std::max<std::size_t>(chunk_count, 1));
+
+    std::vector<CompressedChunk> chunks(chunk_count);
+    std::vector<Buffer> worker_buffers(thread_count, codec.buffers);
+    parallel_for(chunk_count, thread_count, [&](std::size_t chunk_index, std::size_t worker_index) {
+        const std::size_t begin = chunk_index * chunk_size;
+        const std::size_t size = std::min(chunk_size, files->buffer_size - begin);
+        compress_chunk(codec, worker_buffers[worker_index], files->buffer + begin, size, chunks[chunk_index]);
+    });
+    if (codec.is_stats()) {
+        for (const CompressedChunk &chunk : chunks) {
+            codec.add_tokens(chunk.tokens);
+        }
+    }
+
+    BitsetWriter bitset_writer(codec);
+    bitset_writer.write_bits(static_cast<uint32_t>(chunk_size), 32);
+    bitset_writer.write_bits(static_cast<uint32_t>(chunk_count), 32);
+    for (const CompressedChunk &chunk : chunks) {
+        bitset_writer.write_bits(chunk.get_table_entry(), 32);
+    }
+    for (const CompressedChunk &chunk : chunks) {
+        bitset_writer.write_bytes(chunk.bytes.data(), chunk.bytes.size());
+    }
+
+    bitset_writer.flush_to_file_after_compression(false, false, true);
+}
+
+/**
+ * @brief Writes a big-endian 32-bit word of a container to the output.
+ * @param files File manager owning the output.
+ * @param word Word to write.
+ */
+void write_container_word(File *files, uint32_t word) {
+    const uint8_t bytes[4] = {static_cast<uint8_t>(word >> 24), static_cast<uint8_t>(word >> 16),
+                              static_cast<uint8_t>(word >> 8), static_cast<uint8_t>(word)};
+    files->write_output(bytes, sizeof(bytes));
+}
+
+/**
+ * @brief Compresses the input stream in bounded memory (compress_stream()).
+ *
+ * The input is read one batch of chunks at a time (one chunk per worker, `Codec::get_chunk_size()` or
+ * DEFAULT_STREAM_CHUNK_SIZE bytes each), the batch is compressed in parallel and written out before the next one
+ * is read, so memory use depends on chunk size and thread count only. The output is a chunk container whose
+ * chunk count is STREAMED_CHUNK_COUNT: as the number of chunks is not known up front, every chunk is preceded by
+ * its table entry and a zero entry ends the container. With -m the delta encoding continues across chunks, so the
+ * chunk bytes equal those of compress_chunks() for the same chunk size.
+ *
+ * @param codec State of the current codec call.
+ */
+void compress_streamed(Codec &codec) {
+    File *files = codec.files;
+    const std::size_t chunk_size =
+        codec.get_chunk_size() > 0 ? codec.get_chunk_size() : DEFAULT_STREAM_CHUNK_SIZE;
+    const std::size_t thread_count = codec.get_thread_count();
+
+    CompressionHeader header{};
+    header.mode = 0;
+    header.is_file_compressed = 1;
+    header.is_preprocessed = codec.is_preprocess();
+    header.is_chunked = 1;
+    header.width = static_cast<unsigned>(codec.get_width());
+    header.geometry = codec.geometry;
+    header.entropy = codec.options.entropy;
+    const auto header_bytes = header.get_bytes();
+    files->write_output(header_bytes.data(), header_bytes.size());
+    write_container_word(files, static_cast<uint32_t>(chunk_size));
+    write_container_word(files, static_cast<uint32_t>(STREAMED_CHUNK_COUNT));
+
+    std::vector<std::vector<uint8_t>> inputs(thread_count, std::vector<uint8_t>(chunk_size));
+    std::vector<std::size_t> input_sizes(thread_count, 0);
+    std::vector<CompressedChunk> chunks(thread_count);
+    std::vector<Buffer> worker_buffers(thread_count, codec.buffers);
+    uint8_t previous_byte = 0;
+
+    while (!files->EOF_reached) {
+        std::size_t chunk_count = 0;
+        while (chunk_count < thread_count && !files->EOF_reached) {
+            const std::size_t size = files->read_input(inputs[chunk_count].data(), chunk_size);
+            if (size == 0) {
+                break;
+            }
+            if (codec.is_preprocess()) {
+                PhaseTimer timer(codec, "preprocess");
+                previous_byte = delta_encode(inputs[chunk_count].data(), size, previous_byte);
+            }
+            input_sizes[chunk_count++] = size;
+        }
+
+        parallel_for(chunk_count, thread_count, [&](std::size_t chunk_index, std::size_t worker_index) {
+            compress_chunk(codec, worker_buffers[worker_index], inputs[chunk_index].data(),
+                           input_sizes[chunk_index], chunks[chunk_index]);
+        });
+
+        for (std::size_t i = 0; i < chunk_count; i++) {
+            if (codec.is_stats()) {
+                codec.add_tokens(chunks[i].tokens);
+            }
+            const uint32_t entry = chunks[i].get_table_entry();
+            const uint8_t entry_bytes[4] = {static_cast<uint8_t>(entry >> 24), static_cast<uint8_t>(entry >> 16),
+                                            static_cast<uint8_t>(entry >> 8), static_cast<uint8_t>(entry)};
+            files->write_output(entry_bytes, sizeof(entry_bytes), chunks[i].bytes.data(), chunks[i].bytes.size());
+        }
+    }
+
+    write_container_word(files, 0);
+}
+
+/**
+ * @brief Performs full LZSS compression in static mode.
+ *
+ * Initializes buffers, processes input with matching or literal encoding,
+ * and flushes output data and header using BitsetWriter.
+ *
+ * @param codec State of the current codec call.
+ */
+void compress(Codec &codec) {
+    Buffer *buffers = &codec.buffers;
+    File *files = codec.files;
+    BitsetWriter bitset_writer(codec);
+
+    if (codec.is_preprocess()) {
+        PhaseTimer timer(codec, "preprocess");
+        delta_encode(files->get_writable_buffer(), files->buffer_size, 0);
+        files->is_buffer_delta_encoded = true;
+    }
+
+    if (codec.get_chunk_size() > 0) {
+        compress_chunks(codec);
+        return;
+    }
+
+    if (codec.options.entropy == EntropyCoder::RAW &&
+        is_clearly_incompressible(files->buffer, files->buffer_size, codec.geometry)) {
+        bitset_writer.set_stored();
+        bitset_writer.flush_to_file_after_compression();
+        return;
+    }
+
+    std::unique_ptr<SuffixArrayMatchFinder> suffix_array_matches;
+    if (codec.is_suffix_array()) {
+        PhaseTimer timer(codec, "suffix_array");
+        suffix_array_matches =
+            std::make_unique<SuffixArrayMatchFinder>(files->buffer, files->buffer_size, codec.geometry);
+    }
+
+    buffers->reset(files->buffer, files->buffer_size);
+    buffers->precomputed_matches = suffix_array_matches.get();
+
+    {
+        PhaseTimer timer(codec, "encode");
+        StaticProcessor::compress_stream(codec, *buffers, bitset_writer);
+    }
+
+    // Process end
+    //    process_end(codec, bitset_writer);
+
+    bitset_writer.flush_to_file_after_compression();
+}
+
+/**
+ * @brief Decodes all tokens of the compressed stream into the written data.
+ *
+ * The output is preallocated for the largest size the remaining bits can decode to (every match token yielding
+ * the maximum length), written through a pointer and trimmed at the end; back-references are resolved directly
+ * in that buffer. One refill per token is enough: a match token is peeked and split into offset and length at
+ * once. The field widths are template parameters, so the shifts and masks are constants of each instantiation.
+ * Shared by the static and adaptive decoders.
+ *
+ * @tparam OffsetBits Offset field width of the token geometry.
+ * @tparam LengthBits Length field width of the token geometry.
+ * @param bitset_reader Reader positioned at the first token.
+ * @param written_data Output the decoded bytes are appended to.
+ */
+template <std::size_t OffsetBits, std::size_t LengthBits>
+void decompress_tokens(BitsetReader &bitset_reader, std::vector<uint8_t> &written_data) {
+    constexpr uint32_t match_token_bits = FLAG_SIZE_BITS + OffsetBits + LengthBits;
+    constexpr uint32_t offset_mask = (1u << OffsetBits) - 1;
+    constexpr uint32_t length_mask = (1u << LengthBits) - 1;
+
+    const std::size_t written_size = written_data.size();
+    const std::size_t max_output_size = (bitset_reader.remaining_bits() / match_token_bits + 1) * length_mask;
+    written_data.resize(written_size + max_output_size + MATCH_COPY_SLACK);
+    uint8_t *const output_begin = written_data.data();
+    uint8_t *output = output_begin + written_size;
+
+    // Continue while there are still bytes or unread bit
+    while (!bitset_reader.is_at_the_end_of_file()) {
+        bitset_reader.refill();
+
+        if (bitset_reader.peek(FLAG_SIZE_BITS) == 1) { // Compressed token.
+            const uint32_t token = bitset_reader.peek(match_token_bits);
+            bitset_reader.consume(match_token_bits);
+            const uint32_t offset = (token >> LengthBits) & offset_mask;
+            const uint32_t length = token & length_mask;
+
+            // The token's offset is defined relative to the end of the window (the output written so far).
+            if (offset >= static_cast<std::size_t>(output - output_begin)) {
+                throw std::runtime_error("Invalid offset during decompression.");
+            }
+            copy_match(output, offset + 1, length);
+            output += length;
+        } else { // Literal token.
+            bitset_reader.consume(FLAG_SIZE_BITS);
+            *output++ = static_cast<uint8_t>(bitset_reader.read_bits(CHARACTER_SIZE_BITS));
+            // A single trailing literal ends the stream.
+            if (bitset_reader.is_at_the_end_of_file()) {
+                break;
+            }
+            *output++ = static_cast<uint8_t>(bitset_reader.read_bits(CHARACTER_SIZE_BITS));
+        }
+    }
+
+    written_data.resize(output - output_begin);
+}
+
+/**
+ * @brief Calls the `decompress_tokens` instantiation of a token geometry.
+ *
+ * Walks the selectable widths at compile time until they match the runtime geometry, so one instantiation exists
+ * per (offset, length) pair.
+ *
+ * @tparam OffsetBits Offset width tried by this level of the recursion.
+ * @tparam LengthBits Length width tried by this level of the recursion.
+ * @param bitset_reader Reader positioned at the first token.
+ * @param geometry Token geometry from the compression header (must be valid).
+ * @param written_data Output the decoded bytes are appended to.
+ */
+template <std::size_t OffsetBits = MIN_OFFSET_SIZE_BITS, std::size_t LengthBits = MIN_LENGTH_SIZE_BITS>
+void decompress_tokens(BitsetReader &bitset_reader, const TokenGeometry &geometry,
+                       std::vector<uint8_t> &written_data) {
+    if (geometry.offset_bits == OffsetBits && geometry.length_bits == LengthBits) {
+        decompress_tokens<OffsetBits, LengthBits>(bitset_reader, written_data);
+    } else if constexpr (LengthBits < MAX_LENGTH_SIZE_BITS) {
+        decompress_tokens<OffsetBits, LengthBits + 1>(bitset_reader, geometry, written_data);
+    } else if constexpr (OffsetBits < MAX_OFFSET_SIZE_BITS) {
+        decompress_tokens<OffsetBits + 1, MIN_LENGTH_SIZE_BITS>(bitset_reader, geometry, written_data);
+    } else {
+        throw std::runtime_error("Bad decompression format - bad token geometry");
+    }
+}
+
+/**
+ * @brief Decodes a token stream with the geometry and entropy coder of its header.
+ * @param bitset_reader Reader positioned at the first token.
+ * @param header Compression header of the stream.
+ * @param written_data Output the decoded bytes are appended to.
+ */
+void decode_tokens(BitsetReader &bitset_reader, const CompressionHeader &header, std::vector<uint8_t> &written_data) {
+    switch (header.entropy) {
+    case EntropyCoder::HUFFMAN:
+        HuffmanCoder::decode_tokens(bitset_reader, header.geometry, written_data);
+        break;
+    case EntropyCoder::RANS:
+        RansCoder::decode_tokens(bitset_reader, header.geometry, written_data);
+        break;
+    case EntropyCoder::ARITHMETIC:
+        ArithmeticCoder::decode_tokens(
+            bitset_reader, header.geometry,
+            ArithmeticCoder::context_row_distance(header.get_is_adaptive(), header.width), written_data);
+        break;
+    default:
+        decompress_tokens(bitset_reader, header.geometry, written_data);
+        break;
+    }
+}
+
+/**
+ * @brief Reads a big-endian 32-bit word of a container from the input.
+ * @param files File manager owning the input.
+ * @return The word.
+ * @throws std::runtime_error if the input ends first
+ */
+uint32_t read_container_word(File *files) {
+    uint8_t bytes[4];
+    if (files->read_input(bytes, sizeof(bytes)) != sizeof(bytes)) {
+        throw std::runtime_error("Bad decompression format - truncated chunk table");
+    }
+    return read_uint32_big_endian(bytes);
+}
+
+/**
+ * @brief Decompresses a chunk container (see compress_chunks() and compress_streamed()).
+ *
+ * The container is read through `File::read_input()` one batch of chunks at a time (one chunk per worker); the
+ * batch is decoded on a pool of `Codec::get_thread_count()` workers and written out in order before the next
+ * one is read, so memory use is bounded by chunk size and thread count whether the input is streamed or loaded.
+ * Every chunk but the last must decode to exactly the chunk size.
+ *
+ * @param codec State of the current codec call.
+ * @param header CompressionHeader object containing encoding metadata.
+ * @throws std::runtime_error if the chunk table or a chunk is malformed
+ */
+void decompress_chunks(Codec &codec, CompressionHeader &header) {
+    File *files = codec.files;
+    const std::size_t chunk_size = read_container_word(files);
+    const std::size_t chunk_count = read_container_word(files);
+    const bool is_framed = chunk_count == STREAMED_CHUNK_COUNT;
+    if (chunk_size == 0 || chunk_size > MAX_CHUNK_SIZE) {
+        throw std::runtime_error("Bad decompression format - bad chunk size");
+    }
+
+    // A table in front of the chunks is read completely; framed chunks carry their entry themselves.
+    std::vector<uint32_t> table;
+    for (std::size_t i = 0; !is_framed && i < chunk_count; i++) {
+        table.push_back(read_container_word(files));
+    }
+
+    const std::size_t thread_count = codec.get_thread_count();
+    std::vector<uint32_t> entries(thread_count);
+    std::vector<std::vector<uint8_t>> inputs(thread_count);
+    std::vector<std::vector<uint8_t>> outputs(thread_count);
+    std::size_t next_chunk = 0;
+    bool is_last_chunk_short = false;
+    bool is_end = false;
+    uint8_t previous_byte = 0;
+
+    while (!is_end) {
+        std::size_t batch_size = 0;
+        while (batch_size < thread_count) {
+            const uint32_t entry = is_framed ? read_container_word(files)
+                                             : (next_chunk < chunk_count ? table[next_chunk] : 0);
+            if (entry == 0) {
+                is_end = true;
+                break;
+            }
+            next_chunk++;
+            const std::size_t size = entry >> CHUNK_FLAG_BITS;
+            if (size > chunk_size) {
+                throw std::runtime_error("Bad decompression format - chunk size mismatch");
+            }
+            inputs[batch_size].resize(size);
+            if (files->read_input(inputs[batch_size].data(), size) != size) {
+                throw std::runtime_error("Bad decompression format - chunk exceeds the input");
+            }
+            entries[batch_size++] = entry;
+        }
+
+        parallel_for(batch_size, thread_count, [&](std::size_t chunk_index, std::size_t) {
+            const std::vector<uint8_t> &input = inputs[chunk_index];
+            std::vector<uint8_t> &output = outputs[chunk_index];
+            if (((entries[chunk_index] >> 3) & 0b1) == 1) {
+                output = input;
+                return;
+            }
+            output.clear();
+            PhaseTimer timer(codec, "decode");
+            BitsetReader bitset_reader(input.data(), input.data() + input.size(), entries[chunk_index] & 0b111);
+            decode_tokens(bitset_reader, header, output);
+        });
+
+        for (std::size_t i = 0; i < batch_size; i++) {
+            std::vector<uint8_t> &output = outputs[i];
+            if (output.size() > chunk_size || is_last_chunk_short) {
+                throw std::runtime_error("Bad decompression format - chunk size mismatch");
+            }
+            is_last_chunk_short = output.size() < chunk_size;
+            if (header.get_is_preprocessed()) {
+                PhaseTimer timer(codec, "preprocess");
+                previous_byte = delta_decode(output.data(), output.size(), previous_byte);
+            }
+            files->write_output(output.data(), output.size());
+        }
+    }
+}
+
+/**
+ * @brief Performs full decompression of a static-mode LZSS encoded stream.
+ *
+ * Reads tokens using BitsetReader, processes either compressed or literal
+ * sequences, and reconstructs the original file. Handles optional preprocessing.
+ *
+ * @param codec State of the current codec call.
+ * @param header CompressionHeader object containing encoding metadata.
+ */
+void decompress(Codec &codec, CompressionHeader &header) {
+    if (header.get_is_chunked()) {
+        decompress_chunks(codec, header);
+        return;
+    }
+    codec.files->load_remaining_input();
+    {
+        PhaseTimer timer(codec, "decode");
+        BitsetReader bitset_reader(codec, header);
+        decode_tokens(bitset_reader, header, codec.files->written_data);
+    }
+
+    if (header.get_is_preprocessed()) {
+        PhaseTimer timer(codec, "preprocess");
+        delta_decode(codec.files->written_data);
+    }
+
+    codec.files->flush_to_file_not_compressed();
+}
+} // namespace StaticProcessor
+
+/**
+ * @namespace AdaptiveProcessor
+ * @brief Contains compression and decompression logic for adaptive mode.
+ *
+ * This namespace handles adaptive scanning modes (horizontal and vertical),
+ * evaluates both methods, and chooses the more efficient one (in terms of size).
+ */
+
+namespace AdaptiveProcessor {
+/**
+ * @brief Builds suffix-array matches over the prepared block stream if requested (-s).
+ *
+ * @param codec State of the current codec call.
+ * @param buffers Buffers of the pass, already reset to `stream`.
+ * @param stream Prepared block stream of the pass.
+ * @return Match finder attached to `buffers`, or nullptr when the hash chain is used.
+ */
+std::unique_ptr<SuffixArrayMatchFinder> precompute_matches(Codec &codec, Buffer &buffers,
+                                                           const std::vector<uint8_t> &stream) {
+    if (!codec.is_suffix_array()) {
+        return nullptr;
+    }
+    PhaseTimer timer(codec, "suffix_array");
+    auto suffix_array_matches = std::make_unique<SuffixArrayMatchFinder>(stream.data(), stream.size(), codec.geometry);
+    buffers.precomputed_matches = suffix_array_matches.get();
+    return suffix_array_matches;
+}
+
+/**
+ * @brief Performs adaptive compression using horizontal scanning order.
+ *
+ * Prepares the block stream in horizontal order, performs LZSS compression, and returns a BitsetWriter
+ * containing the result. The pass only reads shared codec state, so it can run next to the vertical one.
+ *
+ * @param codec State of the current codec call.
+ * @param buffers Window and match finder state owned by this pass.
+ * @return BitsetWriter containing the compressed byte stream.
+ */
+BitsetWriter compress_horizontal(Codec &codec, Buffer &buffers) {
+    BitsetWriter bitset_writer(codec);
+
+    const std::vector<uint8_t> stream = codec.files->prepare_adaptive_blocks_for_compression(false);
+    buffers.reset(stream.data(), stream.size());
+    const auto suffix_array_matches = precompute_matches(codec, buffers, stream);
+
+    PhaseTimer timer(codec, "pass_horizontal");
+    StaticProcessor::compress_stream(codec, buffers, bitset_writer);
+
+    return bitset_writer;
+}
+
+/**
+ * @brief Performs adaptive compression using vertical scanning order.
+ *
+ * Prepares the block stream with every block transposed, performs LZSS compression, and returns a BitsetWriter
+ * with the result. The pass only reads shared codec state, so it can run next to the horizontal one.
+ *
+ * @param codec State of the current codec call.
+ * @param buffers Window and match finder state owned by this pass.
+ * @return BitsetWriter containing the vertically compressed byte stream.
+ */
+BitsetWriter compress_vertical(Codec &codec, Buffer &buffers) {
+    BitsetWriter bitset_writer(codec);
+
+    const std::vector<uint8_t> stream = codec.files->prepare_adaptive_blocks_for_compression(true);
+    buffers.reset(stream.data(), stream.size());
+    const auto suffix_array_matches = precompute_matches(codec, buffers, stream);
+
+    PhaseTimer timer(codec, "pass_vertical");
+    StaticProcessor::compress_stream(codec, buffers, bitset_writer);
+
+    return bitset_writer;
+}
+
+/**
+ * @brief Estimates how many bits each block of a prepared stream costs with greedy parsing.
+ *
+ * Every token is charged to the block its first byte lies in.
+ *
+ * @param buffers Window and match finder state owned by the caller.
+ * @param stream Prepared block stream.
+ * @param geometry Token geometry the stream will be coded with.
+ * @return Estimated bits per block.
+ */
+std::vector<std::size_t> estimate_block_bits(Buffer &buffers, const std::vector<uint8_t> &stream,
+                                             const TokenGeometry &geometry) {
+    const std::size_t block_size = ADAPTIVE_BLOCK_WIDTH * ADAPTIVE_BLOCK_HEIGHT;
+    std::vector<std::size_t> block_bits((stream.size() + block_size - 1) / block_size, 0);
+
+    buffers.reset(stream.data(), stream.size());
+    buffers.dispatch_match_finder([&](auto finder) {
+        constexpr MatchFinderType Finder = decltype(finder)::value;
+        while (buffers.lookahead_size() > 0) {
+            const std::size_t block_index = buffers.position / block_size;
+            const lz_match match = buffers.find_match<Finder>();
+            if (match.found) {
+                block_bits[block_index] += geometry.match_token_bits();
+                buffers.advance<Finder>(match.length);
+            } else {
+                block_bits[block_index] += LITERAL_TOKEN_BITS;
+                buffers.advance<Finder>(std::min<std::size_t>(2, buffers.lookahead_size()));
+            }
+        }
+    });
+    return block_bits;
+}
+
+/**
+ * @brief Chooses the scan direction of every block (-p).
+ *
+ * Both full scan orders are estimated concurrently (greedy token bits per block), then the directions are chosen
+ * as the cheapest path through the blocks with DIRECTION_SWITCH_BITS charged per change of direction; ties keep
+ * the horizontal scan.
+ *
+ * @param codec State of the current codec call.
+ * @return Per block, whether it is scanned vertically.
+ */
+std::vector<bool> choose_block_directions(Codec &codec) {
+    const File *file = codec.files;
+
+    auto estimate = [&](Buffer &buffers, bool is_vertical) {
+        const std::vector<uint8_t> stream = file->prepare_adaptive_blocks_for_compression(is_vertical);
+        PhaseTimer timer(codec, "pass_estimate");
+        return estimate_block_bits(buffers, stream, codec.geometry);
+    };
+    Buffer vertical_buffers = codec.buffers;
+    auto vertical_bits = std::async(std::launch::async, estimate, std::ref(vertical_buffers), true);
+    const std::vector<std::size_t> horizontal_bits = estimate(codec.buffers, false);
+    const std::vector<std::size_t> vertical = vertical_bits.get();
+
+    // Switching the direction costs the matches into the differently scanned blocks before it, so the choice is
+    // a cheapest path over (block, direction) with a penalty per switch.
+    const std::size_t block_count = horizontal_bits.size();
+    std::vector<std::array<std::size_t, 2>> path_bits(block_count);
+    std::vector<std::array<bool, 2>> came_from_vertical(block_count);
+    for (std::size_t i = 0; i < block_count; i++) {
+        const std::array<std::size_t, 2> block_bits = {horizontal_bits[i], vertical[i]};
+        for (std::size_t direction = 0; direction < 2; direction++) {
+            if (i == 0) {
+                path_bits[i][direction] = block_bits[direction];
+                continue;
+            }
+            const std::size_t stay = path_bits[i - 1][direction];
+            const std::size_t other = path_bits[i - 1][1 - direction] + DIRECTION_SWITCH_BITS;
+            path_bits[i][direction] = std::min(stay, other) + block_bits[direction];
+            came_from_vertical[i][direction] = (other < stay) ? direction == 0 : direction == 1;
+        }
+    }
+
+    std::vector<bool> block_is_vertical(block_count);
+    bool is_vertical = block_count > 0 && path_bits[block_count - 1][1] < path_bits[block_count - 1][0];
+    for (std::size_t i = block_count; i > 0; i--) {
+        block_is_vertical[i - 1] = is_vertical;
+        is_vertical = came_from_vertical[i - 1][is_vertical];
+    }
+    return block_is_vertical;
+}
+
+/**
+ * @brief Performs adaptive compression with a scan direction per block.
+ *
+ * The stream starts with a side channel: the block count (32 bits) and one bit per block (1 = vertical). The
+ * LZSS tokens of the mixed block stream follow.
+ *
+ * @param codec State of the current codec call.
+ * @param buffers Window and match finder state owned by this pass.
+ * @param block_is_vertical Per block, whether it is scanned vertically.
+ * @return BitsetWriter containing the side channel and the compressed byte stream.
+ */
+BitsetWriter compress_per_block(Codec &codec, Buffer &buffers, const std::vector<bool> &block_is_vertical) {
+    BitsetWriter bitset_writer(codec);
+
+    bitset_writer.write_bits(static_cast<uint32_t>(block_is_vertical.size()), 32);
+    for (const bool is_vertical : block_is_vertical) {
+        bitset_writer.write_bits(is_vertical, 1);
+    }
+
+    const std::vector<uint8_t> stream = codec.files->prepare_adaptive_blocks_for_compression(block_is_vertical);
+    buffers.reset(stream.data(), stream.size());
+    const auto suffix_array_matches = precompute_matches(codec, buffers, stream);
+
+    PhaseTimer timer(codec, "pass_per_block");
+    StaticProcessor::compress_stream(codec, buffers, bitset_writer);
+
+    return bitset_writer;
+}
+
+/**
+ * @brief Chooses the better adaptive compression strategy (horizontal or vertical).
+ *
+ * Compares the size of horizontal and vertical compressed outputs, and writes the
+ * more efficient one to the output file. This function performs both compressions
+ * and selects the smallest output. With -p a third candidate scans every block in its own direction.
+ *
+ * The passes run concurrently: every pass but the horizontal one gets its own copy of the buffers and runs on
+ * another thread, and the choice only happens after all finished, so the output equals the serial result.
+ *
+ * @param codec State of the current codec call.
+ */
+void compress(Codec &codec) {
+    std::vector<bool> block_is_vertical;
+    if (codec.is_per_block_passage()) {
+        block_is_vertical = choose_block_directions(codec);
+    }
+
+    Buffer vertical_buffers = codec.buffers;
+    Buffer per_block_buffers = codec.buffers;
+    auto vertical_pass =
+        std::async(std::launch::async, compress_vertical, std::ref(codec), std::ref(vertical_buffers));
+    std::future<BitsetWriter> per_block_pass;
+    if (codec.is_per_block_passage()) {
+        per_block_pass = std::async(std::launch::async, compress_per_block, std::ref(codec),
+                                    std::ref(per_block_buffers), std::cref(block_is_vertical));
+    }
+    BitsetWriter horizontal_writer = compress_horizontal(codec, codec.buffers);
+    BitsetWriter vertical_writer = vertical_pass.get();
+    //    horizontal_writer.write_all_to_file(false);
+    //    vertical_writer.write_all_to_file(true);
+
+    if (per_block_pass.valid()) {
+        BitsetWriter per_block_writer = per_block_pass.get();
+        const std::size_t per_block_size = per_block_writer.get_byte_count();
+        if (per_block_size < horizontal_writer.get_byte_count() && per_block_size < vertical_writer.get_byte_count()) {
+            per_block_writer.flush_to_file_after_compression(false, true);
+            return;
+        }
+    }
+
+    if (horizontal_writer.get_byte_count() <= vertical_writer.get_byte_count()) {
+        horizontal_writer.flush_to_file_after_compression(false);
+    } else {
+        vertical_writer.flush_to_file_after_compression(true);
+    }
+}
+
+/**
+ * @brief Performs adaptive decompression based on the metadata in the header.
+ *
+ * Reads compressed tokens (either literal or matched sequences) using BitsetReader,
+ * and reconstructs the original image in place, considering transposed order if needed.
+ * Final decompressed image is written with a single write.
+ *
+ * @param codec State of the current codec call.
+ * @param header CompressionHeader containing metadata like width, mode, and preprocessing flags.
+ */
+void decompress(Codec &codec, CompressionHeader &header) {
+    codec.files->load_remaining_input();
+    BitsetReader bitset_reader(codec, header);
+    auto *file = codec.files;
+
+    // Per-block scan directions precede the tokens.
+    std::vector<bool> block_is_vertical;
+    if (header.get_is_per_block()) {
+        // One bit per block follows the count; a larger count can only come from a corrupt stream.
+        const std::size_t direction_count = bitset_reader.read_bits(32);
+        if (direction_count > bitset_reader.remaining_bits()) {
+            throw std::runtime_error("Bad decompression format - block direction count mismatch");
+        }
+        block_is_vertical.resize(direction_count);
+        for (std::size_t i = 0; i < block_is_vertical.size(); i++) {
+            block_is_vertical[i] = bitset_reader.read_bits(1) == 1;
+        }
+    }
+
+    {
+        PhaseTimer timer(codec, "decode");
+        StaticProcessor::decode_tokens(bitset_reader, header, file->written_data);
+    }
+
+    // If originally transposed, reverse it
+    const std::size_t block_size = ADAPTIVE_BLOCK_WIDTH * ADAPTIVE_BLOCK_HEIGHT;
+    const std::size_t block_count = (file->written_data.size() + block_size - 1) / block_size;
+    if (header.get_is_per_block()) {
+        if (block_is_vertical.size() != block_count) {
+            throw std::runtime_error("Bad decompression format - block direction count mismatch");
+        }
+    } else {
+        block_is_vertical.assign(block_count, header.get_is_vertical());
+    }
+    file->restore_adaptive_blocks(header, block_is_vertical);
+
+    // The blocks are stored in raster scan order, so the restored stream is written as is
+    file->flush_to_file_not_compressed();
+}
+} // namespace AdaptiveProcessor
+
+/**
+ * @brief Handles decompression of files that were not compressed.
+ *
+ * The rest of the input is copied to the output in pieces of INPUT_REFILL_SIZE bytes with `File::read_input()`,
+ * so stored files are passed through in bounded memory when streaming.
+ *
+ * @param codec State of the current codec call.
+ */
+void decompress_not_compressed(Codec &codec) {
+    std::vector<uint8_t> piece(INPUT_REFILL_SIZE);
+    while (!codec.files->EOF_reached) {
+        const std::size_t size = codec.files->read_input(piece.data(), piece.size());
+        codec.files->write_output(piece.data(), size);
+    }
+}
+
+/**
+ * @brief Reads and reconstructs the compression header from the compressed file.
+ *
+ * This reads the first 3 bytes of the input file (6 or 7 when extended), extracts bitfields representing
+ * compression flags, and builds a `CompressionHeader` object for use during decompression.
+ *
+ * @param codec State of the current codec call.
+ * @return CompressionHeader Structure filled with parsed metadata.
+ */
+CompressionHeader pre_decompress(Codec &codec) {
+    uint8_t header_bytes[3];
+    if (codec.files->read_input(header_bytes, sizeof(header_bytes)) != sizeof(header_bytes)) {
+        throw std::runtime_error("Bad decompression format - missing header");
+    }
+    const uint8_t byte1 = header_bytes[0];
+    const uint8_t byte2 = header_bytes[1];
+    const uint8_t byte3 = header_bytes[2];
+
+    CompressionHeader header;
+    header.padding_bits_count = byte1 & 0b00000111;                 // bits 0-2
+    header.mode = (byte1 >> 3) & 0b1;                               // bit 3
+    header.passage = (byte1 >> 4) & 0b1;                            // bit 4
+    header.is_file_compressed = (byte1 >> 5) & 0b1;                 // bit 5
+    header.is_preprocessed = (byte1 >> 6) & 0b1;                    // bit 6
+    header.is_per_block = header.mode == 1 && ((byte1 >> 7) & 0b1); // bit 7, adaptive mode
+    header.is_chunked = header.mode == 0 && ((byte1 >> 7) & 0b1);   // bit 7, static mode
+    header.width = static_cast<unsigned>(byte2 | (byte3 << 8));     // 16-bit width
+
+    // A zero width announces the extended header: the width and the token geometry follow.
+    if (header.width == 0) {
+        uint8_t extension[3];
+        if (codec.files->read_input(extension, sizeof(extension)) != sizeof(extension)) {
+            throw std::runtime_error("Bad decompression format - missing header");
+        }
+        header.width = static_cast<unsigned>(extension[0] | (extension[1] << 8));
+        header.geometry.offset_bits = MIN_OFFSET_SIZE_BITS + (extension[2] & 0b1111);
+        header.geometry.length_bits = MIN_LENGTH_SIZE_BITS + ((extension[2] >> 4) & 0b111);
+        if (!header.geometry.is_valid()) {
+            throw std::runtime_error("Bad decompression format - bad token geometry");
+        }
+        if ((extension[2] & 0b10000000) != 0) {
+            uint8_t entropy = 0;
+            if (codec.files->read_input(&entropy, sizeof(entropy)) != sizeof(entropy)) {
+                throw std::runtime_error("Bad decompression format - missing header");
+            }
+            // Raw tokens never announce the byte; the last enumerator is the newest coder.
+            if (entropy == static_cast<uint8_t>(EntropyCoder::RAW) ||
+                entropy > static_cast<uint8_t>(EntropyCoder::ARITHMETIC)) {
+                throw std::runtime_error("Bad decompression format - unknown entropy coder");
+            }
+            header.entropy = static_cast<EntropyCoder>(entropy);
+        }
+    }
+
+    std::bitset<8> b1(byte1), b2(byte2), b3(byte3);
+
+    if (DEBUG_READ_HEADER) {
+        std::cout << "Header bytes:\n";
+        std::cout << "  byte1: " << b1 << " | padding_bits_count: " << int(header.padding_bits_count)
+                  << " | mode: " << bool(header.mode) << " | passage: " << bool(header.passage)
+                  << " | is_compressed: " << bool(header.is_file_compressed) << " | width: " << header.width
+                  << " | is_preprocessed: " << bool(header.is_preprocessed) << std::endl;
+        std::cout << "  byte2: " << b2 << "\n";
+        std::cout << "  byte3: " << b3 << " | width: " << header.width << "\n";
+    }
+
+    return header;
+}
+
+/**
+ * @class VectorOutput
+ * @brief OutputStream that collects the output in memory.
+ */
+class VectorOutput : public OutputStream {
+  public:
+    /**
+     * @brief Appends both ranges to `bytes`.
+     * @param head First range.
+     * @param head_size Size of the first range.
+     * @param body Second range.
+     * @param body_size Size of the second range.
+     */
+    void write(const uint8_t *head, std::size_t head_size, const uint8_t *body, std::size_t body_size) override {
+        bytes.insert(bytes.end(), head, head + head_size);
+        bytes.insert(bytes.end(), body, body + body_size);
+    }
+
+    std::vector<uint8_t> bytes; ///< Output written so far.
+};
+
+void Stats::add_phase(const std::string &name, double seconds) {
+    for (auto &phase : phases) {
+        if (phase.first == name) {
+            phase.second += seconds;
+            return;
+        }
+    }
+    phases.emplace_back(name, seconds);
+}
+
+void Stats::add_tokens(const Stats &other) {
+    match_tokens += other.match_tokens;
+    literal_tokens += other.literal_tokens;
+    literal_bytes += other.literal_bytes;
+    token_bits += other.token_bits;
+    for (std::size_t i = 0; i < match_lengths.size(); i++) {
+        match_lengths[i] += other.match_lengths[i];
+    }
+    for (std::size_t i = 0; i < match_offsets.size(); i++) {
+        match_offsets[i] += other.match_offsets[i];
+    }
+}
+
+/**
+ * @brief Formats a JSON array of counts, without the trailing zero counts.
+ * @param counts Counts to format.
+ * @return JSON array text.
+ */
+template <std::size_t Size> std::string json_array(const std::array<std::size_t, Size> &counts) {
+    std::size_t size = Size;
+    while (size > 0 && counts[size - 1] == 0) {
+        size--;
+    }
+    std::string json = "[";
+    for (std::size_t i = 0; i < size; i++) {
+        json += (i > 0 ? "," : "") + std::to_string(counts[i]);
+    }
+    return json + "]";
+}
+
+/**
+ * @brief Formats a number for JSON with fixed precision.
+ * @param value Number to format.
+ * @return JSON number text.
+ */
+std::string json_number(double value) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.6f", value);
+    return text;
+}
+
+std::string Stats::to_json(double seconds) const {
+    const std::size_t token_count = match_tokens + literal_tokens;
+    const double ratio = input_bytes > 0 ? static_cast<double>(output_bytes) / input_bytes : 0.0;
+    const double megabytes_per_second = seconds > 0 ? input_bytes / seconds / 1e6 : 0.0;
+
+    std::string json = "{\"input_bytes\":" + std::to_string(input_bytes);
+    json += ",\"output_bytes\":" + std::to_string(output_bytes);
+    json += ",\"ratio\":" + json_number(ratio);
+    json += ",\"seconds\":" + json_number(seconds);
+    json += ",\"mb_per_second\":" + json_number(megabytes_per_second);
+    json += ",\"phases\":{";
+    for (std::size_t i = 0; i < phases.size(); i++) {
+        json += (i > 0 ? ",\"" : "\"") + phases[i].first + "\":" + json_number(phases[i].second);
+    }
+    json += "},\"tokens\":{\"matches\":" + std::to_string(match_tokens);
+    json += ",\"literals\":" + std::to_string(literal_tokens);
+    json += ",\"literal_bytes\":" + std::to_string(literal_bytes);
+    json += ",\"bits\":" + std::to_string(token_bits);
+    json += ",\"bits_per_token\":" + json_number(token_count > 0 ? static_cast<double>(token_bits) / token_count : 0.0);
+    json += ",\"match_lengths\":" + json_array(match_lengths);
+    json += ",\"match_offset_bits\":" + json_array(match_offsets);
+    return json + "}}";
+}
+
+/**
+ * @brief Compresses the input held by the codec in static or adaptive mode.
+ * @param codec State of the current codec call.
+ * @throws std::runtime_error on invalid options or input
+ */
+void compress_input(Codec &codec) {
+    codec.get_width();
+    if (!codec.options.is_adaptive) {
+        StaticProcessor::compress(codec);
+        return;
+    }
+    if (codec.get_chunk_size() > 0) {
+        throw std::runtime_error("Chunk containers are only supported in static mode.");
+    }
+    codec.files->is_image_format_ok();
+    AdaptiveProcessor::compress(codec);
+}
+
+/**
+ * @brief Decompresses the input held by the codec, whatever mode it was compressed with.
+ * @param codec State of the current codec call.
+ * @throws std::runtime_error if the compressed data is malformed
+ */
+void decompress_input(Codec &codec) {
+    CompressionHeader header = pre_decompress(codec);
+    if (!header.get_is_compressed()) {
+        decompress_not_compressed(codec);
+    } else if (header.get_is_static()) {
+        StaticProcessor::decompress(codec, header);
+    } else if (header.get_is_adaptive()) {
+        AdaptiveProcessor::decompress(codec, header);
+    } else {
+        throw std::runtime_error("Bad decompression format - Bad mode");
+    }
+}
+
+std::vector<uint8_t> compress(const uint8_t *data, std::size_t size, const Options &options) {
+    VectorOutput output;
+    output.bytes.reserve(size + sizeof(uint32_t));
+    Codec codec(options);
+    File files(codec, data, size, output);
+    codec.files = &files;
+    codec.add_bytes(size, 0);
+    compress_input(codec);
+    return std::move(output.bytes);
+}
+
+void compress_in_place(uint8_t *data, std::size_t size, const Options &options, OutputStream &output) {
+    Codec codec(options);
+    File files(codec, data, size, output);
+    files.writable_buffer = data;
+    codec.files = &files;
+    codec.add_bytes(size, 0);
+    compress_input(codec);
+}
+
+void compress_stream(InputStream &input, const Options &options, OutputStream &output) {
+    Codec codec(options);
+    if (options.is_adaptive) {
+        throw std::runtime_error("Streaming is only supported in static mode.");
+    }
+    codec.get_width();
+    codec.get_chunk_size();
+    File files(codec, input, output);
+    codec.files = &files;
+    StaticProcessor::compress_streamed(codec);
+}
+
+std::vector<uint8_t> decompress(const uint8_t *data, std::size_t size, std::size_t thread_count, Stats *stats) {
+    VectorOutput output;
+    decompress(data, size, output, thread_count, stats);
+    return std::move(output.bytes);
+}
+
+void decompress(const uint8_t *data, std::size_t size, OutputStream &output, std::size_t thread_count,
+                Stats *stats) {
+    Options options;
+    options.thread_count = thread_count;
+    options.stats = stats;
+    Codec codec(options);
+    File files(codec, data, size, output);
+    codec.files = &files;
+    codec.add_bytes(size, 0);
+    decompress_input(codec);
+}
+
+void decompress_stream(InputStream &input, OutputStream &output, std::size_t thread_count, Stats *stats) {
+    Options options;
+    options.thread_count = thread_count;
+    options.stats = stats;
+    Codec codec(options);
+    File files(codec, input, output);
+    codec.files = &files;
+    decompress_input(codec);
+}
+
+} // namespace lz_codec
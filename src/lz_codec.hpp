@@ -0,0 +1,219 @@
+/**
+ * @file lz_codec.hpp
+ * @brief Public interface of the LZSS codec library (liblz_codec).
+ *
+ * The codec compresses and decompresses whole in-memory buffers, or streams through the InputStream /
+ * OutputStream interfaces. Every call owns its state (match finder, window, output), so calls are reentrant and
+ * may run concurrently on different threads. Errors are reported as std::runtime_error.
+ *
+ * @author Zdeněk Lapeš (xlapes02)
+ * @date 26/03/2025
+ */
+
+#ifndef LZ_CODEC_HPP
+#define LZ_CODEC_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace lz_codec {
+
+/**
+ * @enum ParseMode
+ * @brief How the encoder chooses between the matches and literals found in the stream (--parse).
+ */
+enum class ParseMode {
+    GREEDY,  ///< Take the longest match at each position, otherwise a literal pair.
+    LAZY,    ///< Like greedy, but shorten a match by one byte when the next token then reaches further.
+    LAZY2,   ///< Like lazy, also trying to shorten the match by two bytes.
+    OPTIMAL, ///< Pick the token sequence with the fewest bits (dynamic programming over all positions).
+};
+
+/**
+ * @enum EntropyCoder
+ * @brief How the LZ tokens are written to the bitstream (--entropy).
+ */
+enum class EntropyCoder {
+    RAW,        ///< Fixed-width fields: a flag bit, then two 8-bit literals or the offset and length fields.
+    HUFFMAN,    ///< Canonical Huffman codes for literals, match lengths and offset buckets, rebuilt per block.
+    RANS,       ///< Like HUFFMAN, but rANS coded with fractional-bit frequencies and interleaved decoder states.
+    ARITHMETIC, ///< Adaptive binary range coding with contexts from the previous tokens and neighbouring pixels.
+};
+
+/**
+ * @struct Stats
+ * @brief Instrumentation of codec calls (--stats): phase timings, sizes and the emitted tokens.
+ *
+ * A call fills it when it is passed in `Options::stats` or to a decompress function; counts are added to, so one
+ * Stats can sum several calls. Phases of concurrent work (adaptive passes, container chunks) are summed over the
+ * threads. Token counts cover the token streams that end up in the output (compression only).
+ */
+struct Stats {
+    std::vector<std::pair<std::string, double>> phases; ///< Seconds per phase, in the order they first ran.
+    std::size_t input_bytes = 0;                        ///< Bytes read.
+    std::size_t output_bytes = 0;                       ///< Bytes written.
+    std::size_t match_tokens = 0;                       ///< Match tokens written.
+    std::size_t literal_tokens = 0;                     ///< Literal tokens written (pairs; the last may be single).
+    std::size_t literal_bytes = 0;                      ///< Characters carried by the literal tokens.
+    std::size_t token_bits = 0;                         ///< Bits of all counted tokens.
+    std::array<std::size_t, 256> match_lengths{};       ///< Match tokens per length field value.
+    std::array<std::size_t, 21> match_offsets{};        ///< Match tokens per bit length of the offset field.
+
+    /**
+     * @brief Adds time to a phase, creating it on first use.
+     * @param name Phase name.
+     * @param seconds Wall time to add.
+     */
+    void add_phase(const std::string &name, double seconds);
+
+    /**
+     * @brief Adds the token counts of another Stats.
+     * @param other Counts to add.
+     */
+    void add_tokens(const Stats &other);
+
+    /**
+     * @brief Formats the statistics as a JSON object.
+     * @param seconds Wall time of the whole run, which the throughput is computed from.
+     * @return JSON text (one line).
+     */
+    std::string to_json(double seconds) const;
+};
+
+/**
+ * @struct Options
+ * @brief Compression settings; decompression reads everything it needs from the compressed header.
+ */
+struct Options {
+    int width = 1;                            ///< Image width in pixels (>= 1; a multiple of 16 with `is_adaptive`).
+    bool is_adaptive = false;                 ///< Adaptive 16x16 block scanning instead of one static stream (-a).
+    bool is_per_block = false;                ///< Adaptive mode: also try a scan direction per block (-p).
+    bool is_preprocessed = false;             ///< Delta encode the input before compression (-m).
+    bool is_suffix_array = false;             ///< Precompute matches with a suffix array (-s).
+    int level = 6;                            ///< Compression level 1 (fastest) .. 9 (best ratio).
+    int offset_bits = 13;                     ///< Match offset field width 12..20; the window is 2^offset_bits bytes.
+    int length_bits = 5;                      ///< Match length field width 4..8; matches are < 2^length_bits bytes.
+    ParseMode parse_mode = ParseMode::GREEDY; ///< Token selection (--parse).
+    EntropyCoder entropy = EntropyCoder::RAW; ///< Token coding (--entropy).
+    std::size_t chunk_size = 0;               ///< Static mode: container chunk size in bytes, 0 = one stream.
+    std::size_t thread_count = 1;             ///< Worker threads for chunk containers (0 = one per hardware thread).
+    Stats *stats = nullptr;                   ///< Receives the instrumentation of the call (--stats), if set.
+};
+
+/**
+ * @class InputStream
+ * @brief Source of input that is read in pieces (streaming compression and decompression).
+ */
+class InputStream {
+  public:
+    virtual ~InputStream() = default;
+
+    /**
+     * @brief Reads up to `size` bytes.
+     * @param destination Where to store the bytes.
+     * @param size Number of bytes wanted.
+     * @return Number of bytes read; less than `size` only at the end of the input.
+     * @throws std::runtime_error if reading fails
+     */
+    virtual std::size_t read(uint8_t *destination, std::size_t size) = 0;
+};
+
+/**
+ * @class OutputStream
+ * @brief Destination of the compressed or decompressed bytes.
+ */
+class OutputStream {
+  public:
+    virtual ~OutputStream() = default;
+
+    /**
+     * @brief Appends two byte ranges (e.g. a header and its payload) back to back.
+     * @param head First range.
+     * @param head_size Size of the first range.
+     * @param body Second range (may be empty).
+     * @param body_size Size of the second range.
+     * @throws std::runtime_error if writing fails
+     */
+    virtual void write(const uint8_t *head, std::size_t head_size, const uint8_t *body, std::size_t body_size) = 0;
+};
+
+/**
+ * @brief Compresses an in-memory buffer.
+ * @param data First input byte.
+ * @param size Input size.
+ * @param options Compression settings.
+ * @return Compressed bytes (header included).
+ * @throws std::runtime_error on invalid options or input
+ */
+std::vector<uint8_t> compress(const uint8_t *data, std::size_t size, const Options &options);
+
+/**
+ * @brief Compresses an in-memory buffer into an output stream, using the buffer as scratch space.
+ *
+ * Static delta preprocessing (-m) encodes the buffer in place instead of copying it; its contents are unspecified
+ * afterwards.
+ *
+ * @param data First input byte.
+ * @param size Input size.
+ * @param options Compression settings.
+ * @param output Receives the compressed bytes.
+ * @throws std::runtime_error on invalid options or input, or if the output fails
+ */
+void compress_in_place(uint8_t *data, std::size_t size, const Options &options, OutputStream &output);
+
+/**
+ * @brief Compresses a stream in bounded memory as a chunk container (static mode only).
+ *
+ * The input is read one batch of chunks at a time (`Options::chunk_size`, 1 MiB if 0), so memory use depends on
+ * chunk size and thread count, not on the input size.
+ *
+ * @param input Source of the uncompressed bytes.
+ * @param options Compression settings.
+ * @param output Receives the compressed bytes.
+ * @throws std::runtime_error on invalid options, or if the input or output fails
+ */
+void compress_stream(InputStream &input, const Options &options, OutputStream &output);
+
+/**
+ * @brief Decompresses an in-memory buffer.
+ * @param data First compressed byte.
+ * @param size Compressed size.
+ * @param thread_count Worker threads for chunk containers (0 = one per hardware thread).
+ * @param stats Receives the instrumentation of the call, if set.
+ * @return Decompressed bytes.
+ * @throws std::runtime_error if the compressed data is malformed
+ */
+std::vector<uint8_t> decompress(const uint8_t *data, std::size_t size, std::size_t thread_count = 1,
+                                Stats *stats = nullptr);
+
+/**
+ * @brief Decompresses an in-memory buffer into an output stream.
+ * @param data First compressed byte.
+ * @param size Compressed size.
+ * @param output Receives the decompressed bytes.
+ * @param thread_count Worker threads for chunk containers (0 = one per hardware thread).
+ * @param stats Receives the instrumentation of the call, if set.
+ * @throws std::runtime_error if the compressed data is malformed or the output fails
+ */
+void decompress(const uint8_t *data, std::size_t size, OutputStream &output, std::size_t thread_count = 1,
+                Stats *stats = nullptr);
+
+/**
+ * @brief Decompresses a stream; chunk containers and stored data are processed in bounded memory, other formats
+ * are read completely first.
+ * @param input Source of the compressed bytes.
+ * @param output Receives the decompressed bytes.
+ * @param thread_count Worker threads for chunk containers (0 = one per hardware thread).
+ * @param stats Receives the instrumentation of the call, if set.
+ * @throws std::runtime_error if the compressed data is malformed, or if the input or output fails
+ */
+void decompress_stream(InputStream &input, OutputStream &output, std::size_t thread_count = 1,
+                       Stats *stats = nullptr);
+
+} // namespace lz_codec
+
+#endif // LZ_CODEC_HPP
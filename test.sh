@@ -6,6 +6,7 @@ EXECUTABLE=./lz_codec
 
 #make clean
 make
+mkdir -p tests/out
 
 ERRORS=0
 WARNINGS=0
@@ -74,6 +75,64 @@ run_test() {
     echo ""
 }
 
+# Arguments:
+#   $1 -> Test name (for logging)
+#   $2 -> First compressed file
+#   $3 -> Second compressed file, which must be byte-identical to the first
+compare_outputs() {
+    local test_name="$1"
+    local first_file="$2"
+    local second_file="$3"
+
+    echo "----------------------------------------"
+    echo "Running test: ${test_name}"
+    if cmp -s "${first_file}" "${second_file}"; then
+        echo "✅ Test ${test_name}: OK"
+        ((OK++))
+    else
+        echo "❌ Test ${test_name}: FAIL (${first_file} and ${second_file} differ)"
+        ((ERRORS++))
+    fi
+    echo "----------------------------------------"
+    echo ""
+}
+
+# Arguments:
+#   $1 -> Test name (for logging)
+#   $2 -> Compression arguments (input and output are added as stdin / stdout)
+#   $3 -> Decompression arguments (input and output are added as stdin / stdout)
+#   $4 -> Path to original file (piped into the compressor)
+#   $5 -> Path to decompressed file (written from the decompressor's stdout)
+run_pipe_test() {
+    local test_name="$1"
+    local comp_args="$2"
+    local decomp_args="$3"
+    local original_file="$4"
+    local decompressed_file="$5"
+
+    echo "----------------------------------------"
+    echo "Running test: ${test_name}"
+    echo "Pipeline: cat ${original_file} | ${EXECUTABLE} ${comp_args} -i - -o - | ${EXECUTABLE} ${decomp_args} -i - -o -"
+    cat "${original_file}" | $EXECUTABLE ${comp_args} -i - -o - | $EXECUTABLE ${decomp_args} -i - -o - >"${decompressed_file}"
+    local status=("${PIPESTATUS[@]}")
+    if (( status[1] != 0 || status[2] != 0 )); then
+        echo "❌ Pipeline failed for ${test_name} (compression: ${status[1]}, decompression: ${status[2]})"
+        ((ERRORS++))
+        return
+    fi
+
+    echo "Comparing ${original_file} with ${decompressed_file}"
+    if diff "${original_file}" "${decompressed_file}" >/dev/null; then
+        echo "✅ Test ${test_name}: OK"
+        ((OK++))
+    else
+        echo "❌ Test ${test_name}: FAIL (Files differ)"
+        ((ERRORS++))
+    fi
+    echo "----------------------------------------"
+    echo ""
+}
+
 ####################################
 # STATIC TESTS: from tests/in/static
 ####################################
@@ -123,6 +182,108 @@ for file in "${kko_files[@]}"; do
         "tests/in/kko.proj.data/${file}" \
         "tests/in/kko.proj.data/${file}-decompressed.txt"
 
+    # STATIC CHUNK CONTAINER: 96 KiB chunks, so the last of the three is shorter
+    for threads in 1 2 4; do
+        run_test "${file} (static chunks, ${threads} threads)" \
+            "-i tests/in/kko.proj.data/${file} -o tests/out/${file}-t${threads} -w 512 -c --chunk-size 96 -t ${threads}" \
+            "-i tests/out/${file}-t${threads} -o tests/in/kko.proj.data/${file}-decompressed.txt -d -t ${threads}" \
+            "tests/in/kko.proj.data/${file}" \
+            "tests/in/kko.proj.data/${file}-decompressed.txt"
+    done
+    compare_outputs "${file} (static chunks, 1 vs 2 threads)" "tests/out/${file}-t1" "tests/out/${file}-t2"
+    compare_outputs "${file} (static chunks, 1 vs 4 threads)" "tests/out/${file}-t1" "tests/out/${file}-t4"
+
+    # STATIC CHUNK CONTAINER + PREPROCESS
+    run_test "${file} (static chunks + preprocess)" \
+        "-i tests/in/kko.proj.data/${file} -o tests/out/${file} -w 512 -c -m --chunk-size 96 -t 4" \
+        "-i tests/out/${file} -o tests/in/kko.proj.data/${file}-decompressed.txt -d" \
+        "tests/in/kko.proj.data/${file}" \
+        "tests/in/kko.proj.data/${file}-decompressed.txt"
+
+    # STREAMED CONTAINER FROM STDIN TO STDOUT
+    run_pipe_test "${file} (piped)" \
+        "-w 512 -c" \
+        "-d" \
+        "tests/in/kko.proj.data/${file}" \
+        "tests/in/kko.proj.data/${file}-decompressed.txt"
+
+    # STREAMED CONTAINER FROM STDIN TO STDOUT + PREPROCESS
+    run_pipe_test "${file} (piped + preprocess)" \
+        "-w 512 -c -m" \
+        "-d" \
+        "tests/in/kko.proj.data/${file}" \
+        "tests/in/kko.proj.data/${file}-decompressed.txt"
+
+    # STREAMED CONTAINER BETWEEN FILES
+    run_test "${file} (streamed)" \
+        "-i tests/in/kko.proj.data/${file} -o tests/out/${file} -w 512 -c --stream" \
+        "-i tests/out/${file} -o tests/in/kko.proj.data/${file}-decompressed.txt -d --stream" \
+        "tests/in/kko.proj.data/${file}" \
+        "tests/in/kko.proj.data/${file}-decompressed.txt"
+
+    # STATIC, SMALLEST TOKEN GEOMETRY
+    run_test "${file} (static, 12-bit offsets, 4-bit lengths)" \
+        "-i tests/in/kko.proj.data/${file} -o tests/out/${file} -w 512 -c --offset-bits 12 --length-bits 4" \
+        "-i tests/out/${file} -o tests/in/kko.proj.data/${file}-decompressed.txt -d" \
+        "tests/in/kko.proj.data/${file}" \
+        "tests/in/kko.proj.data/${file}-decompressed.txt"
+
+    # STATIC, LARGEST TOKEN GEOMETRY
+    run_test "${file} (static, 20-bit offsets, 8-bit lengths)" \
+        "-i tests/in/kko.proj.data/${file} -o tests/out/${file} -w 512 -c --offset-bits 20 --length-bits 8" \
+        "-i tests/out/${file} -o tests/in/kko.proj.data/${file}-decompressed.txt -d" \
+        "tests/in/kko.proj.data/${file}" \
+        "tests/in/kko.proj.data/${file}-decompressed.txt"
+
+    # ADAPTIVE, MID TOKEN GEOMETRY
+    run_test "${file} (adaptive, 16-bit offsets, 6-bit lengths)" \
+        "-i tests/in/kko.proj.data/${file} -o tests/out/${file} -w 512 -c -a --offset-bits 16 --length-bits 6" \
+        "-i tests/out/${file} -o tests/in/kko.proj.data/${file}-decompressed.txt -d" \
+        "tests/in/kko.proj.data/${file}" \
+        "tests/in/kko.proj.data/${file}-decompressed.txt"
+
+    # STATIC, HUFFMAN-CODED TOKENS
+    run_test "${file} (static, huffman)" \
+        "-i tests/in/kko.proj.data/${file} -o tests/out/${file} -w 512 -c --entropy huffman" \
+        "-i tests/out/${file} -o tests/in/kko.proj.data/${file}-decompressed.txt -d" \
+        "tests/in/kko.proj.data/${file}" \
+        "tests/in/kko.proj.data/${file}-decompressed.txt"
+
+    # STATIC CHUNK CONTAINER, HUFFMAN-CODED TOKENS (one code table per chunk)
+    run_test "${file} (static chunks, huffman)" \
+        "-i tests/in/kko.proj.data/${file} -o tests/out/${file} -w 512 -c --entropy huffman --chunk-size 96 -t 4" \
+        "-i tests/out/${file} -o tests/in/kko.proj.data/${file}-decompressed.txt -d" \
+        "tests/in/kko.proj.data/${file}" \
+        "tests/in/kko.proj.data/${file}-decompressed.txt"
+
+    # STATIC, RANS-CODED TOKENS
+    run_test "${file} (static, rans)" \
+        "-i tests/in/kko.proj.data/${file} -o tests/out/${file} -w 512 -c --entropy rans" \
+        "-i tests/out/${file} -o tests/in/kko.proj.data/${file}-decompressed.txt -d" \
+        "tests/in/kko.proj.data/${file}" \
+        "tests/in/kko.proj.data/${file}-decompressed.txt"
+
+    # STATIC, RANS-CODED TOKENS, LARGEST TOKEN GEOMETRY
+    run_test "${file} (static, rans, 20-bit offsets, 8-bit lengths)" \
+        "-i tests/in/kko.proj.data/${file} -o tests/out/${file} -w 512 -c --entropy rans --offset-bits 20 --length-bits 8" \
+        "-i tests/out/${file} -o tests/in/kko.proj.data/${file}-decompressed.txt -d" \
+        "tests/in/kko.proj.data/${file}" \
+        "tests/in/kko.proj.data/${file}-decompressed.txt"
+
+    # STATIC, RANGE-CODED TOKENS
+    run_test "${file} (static, arithmetic)" \
+        "-i tests/in/kko.proj.data/${file} -o tests/out/${file} -w 512 -c --entropy arithmetic" \
+        "-i tests/out/${file} -o tests/in/kko.proj.data/${file}-decompressed.txt -d" \
+        "tests/in/kko.proj.data/${file}" \
+        "tests/in/kko.proj.data/${file}-decompressed.txt"
+
+    # ADAPTIVE, RANGE-CODED TOKENS (the context model's row distance differs from static mode)
+    run_test "${file} (adaptive, arithmetic)" \
+        "-i tests/in/kko.proj.data/${file} -o tests/out/${file} -w 512 -c -a --entropy arithmetic" \
+        "-i tests/out/${file} -o tests/in/kko.proj.data/${file}-decompressed.txt -d" \
+        "tests/in/kko.proj.data/${file}" \
+        "tests/in/kko.proj.data/${file}-decompressed.txt"
+
     # ADAPTIVE
     run_test "${file} (adaptive)" \
         "-i tests/in/kko.proj.data/${file} -o tests/out/${file} -w 512 -c -a" \
@@ -136,6 +297,63 @@ for file in "${kko_files[@]}"; do
         "-i tests/out/${file} -o tests/in/kko.proj.data/${file}-decompressed.txt -d" \
         "tests/in/kko.proj.data/${file}" \
         "tests/in/kko.proj.data/${file}-decompressed.txt"
+
+    # ADAPTIVE, SCAN DIRECTION PER BLOCK
+    run_test "${file} (adaptive per block)" \
+        "-i tests/in/kko.proj.data/${file} -o tests/out/${file} -w 512 -c -a -p" \
+        "-i tests/out/${file} -o tests/in/kko.proj.data/${file}-decompressed.txt -d" \
+        "tests/in/kko.proj.data/${file}" \
+        "tests/in/kko.proj.data/${file}-decompressed.txt"
+
+    # ADAPTIVE, SCAN DIRECTION PER BLOCK + PREPROCESS
+    run_test "${file} (adaptive per block + preprocess)" \
+        "-i tests/in/kko.proj.data/${file} -o tests/out/${file} -w 512 -c -a -p -m" \
+        "-i tests/out/${file} -o tests/in/kko.proj.data/${file}-decompressed.txt -d" \
+        "tests/in/kko.proj.data/${file}" \
+        "tests/in/kko.proj.data/${file}-decompressed.txt"
+done
+
+########################################
+# EMPTY INPUT
+########################################
+empty_file="tests/out/empty.raw"
+: >"${empty_file}"
+
+run_pipe_test "empty input (piped)" \
+    "-w 512 -c" \
+    "-d" \
+    "${empty_file}" \
+    "tests/out/empty-decompressed.raw"
+
+########################################
+# INCOMPRESSIBLE INPUT
+########################################
+# Random bytes code larger than they are, so the Huffman-coded stream falls back to storing the input.
+random_file="tests/out/random.raw"
+head -c 262144 /dev/urandom >"${random_file}"
+
+for args in "--entropy huffman" "--entropy huffman --chunk-size 96 -t 4"; do
+    run_test "random.raw (stored, ${args})" \
+        "-i ${random_file} -o tests/out/random.lz -w 512 -c ${args}" \
+        "-i tests/out/random.lz -o tests/out/random-decompressed.raw -d" \
+        "${random_file}" \
+        "tests/out/random-decompressed.raw"
+done
+
+########################################
+# ADAPTIVE PER-BLOCK SIDE CHANNEL
+########################################
+# No corpus file is coded smaller with mixed directions, so stack the top half of df1hvx.raw (best scanned
+# horizontally) on the bottom half of shp1.raw (best scanned vertically) to make -p write the side channel.
+mixed_file="tests/out/df1hvx-shp1.raw"
+{ head -c 131072 tests/in/kko.proj.data/df1hvx.raw; tail -c 131072 tests/in/kko.proj.data/shp1.raw; } >"${mixed_file}"
+
+for mode in "" "-m"; do
+    run_test "df1hvx-shp1.raw (adaptive per block ${mode})" \
+        "-i ${mixed_file} -o tests/out/df1hvx-shp1.lz -w 512 -c -a -p ${mode}" \
+        "-i tests/out/df1hvx-shp1.lz -o tests/out/df1hvx-shp1-decompressed.raw -d" \
+        "${mixed_file}" \
+        "tests/out/df1hvx-shp1-decompressed.raw"
 done
 
 ########################################